@@ -21,6 +21,9 @@
 
 #include "mjson.h"
 
+#include <float.h>
+#include <limits.h>
+
 #if defined(_MSC_VER)
 #define alloca _alloca
 #if _MSC_VER < 1700
@@ -29,6 +32,133 @@
 #endif
 #endif
 
+#if MJSON_ENABLE_SIMD
+#include <emmintrin.h>
+#if (defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))) || \
+    (defined(_MSC_VER) && _MSC_VER >= 1700)
+#include <immintrin.h>
+#define MJSON_AVX2 1
+#else
+#define MJSON_AVX2 0
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static int mjson_ctz(unsigned v) {
+#if defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward(&i, v);
+  return (int) i;
+#else
+  return __builtin_ctz(v);
+#endif
+}
+
+// Scan 16-byte blocks of s[i..len) for a byte that is (or, if `neg` is set,
+// is not) one of the `n` characters in `set`. Return the offset of that
+// byte, or the offset of the first unscanned block if none was found.
+static ptrdiff_t mjson_scan_sse2(const char *s, ptrdiff_t i, ptrdiff_t len,
+                                 const char *set, int n, int neg) {
+  __m128i c[8];
+  int k;
+  for (k = 0; k < n; k++) c[k] = _mm_set1_epi8(set[k]);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    __m128i m = _mm_cmpeq_epi8(v, c[0]);
+    unsigned bits;
+    for (k = 1; k < n; k++) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c[k]));
+    bits = (unsigned) _mm_movemask_epi8(m);
+    if (neg) bits ^= 0xffff;
+    if (bits) return i + mjson_ctz(bits);
+  }
+  return i;
+}
+
+#if MJSON_AVX2
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static ptrdiff_t mjson_scan_avx2(const char *s, ptrdiff_t i, ptrdiff_t len,
+                                 const char *set, int n, int neg) {
+  __m256i c[8];
+  int k;
+  for (k = 0; k < n; k++) c[k] = _mm256_set1_epi8(set[k]);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    __m256i m = _mm256_cmpeq_epi8(v, c[0]);
+    unsigned bits;
+    for (k = 1; k < n; k++) {
+      m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c[k]));
+    }
+    bits = (unsigned) _mm256_movemask_epi8(m);
+    if (neg) bits = ~bits;
+    if (bits) return i + mjson_ctz(bits);
+  }
+  return i;
+}
+
+// AVX2 is picked at runtime, so the same binary runs on older CPUs
+static int mjson_has_avx2(void) {
+  static int cached = -1;
+  if (cached < 0) {
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+#else
+    int r[4];
+    cached = 0;
+    __cpuid(r, 0);
+    if (r[0] >= 7) {
+      __cpuid(r, 1);
+      if ((r[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {  // OS saves YMM
+        __cpuidex(r, 7, 0);
+        cached = (r[1] & (1 << 5)) ? 1 : 0;
+      }
+    }
+#endif
+  }
+  return cached;
+}
+#endif  // MJSON_AVX2
+#endif  // MJSON_ENABLE_SIMD
+
+// Return the offset of the first byte in s[i..len) that is (or, if `neg` is
+// set, is not) one of the `n` (at most 8) characters in `set`, or len.
+static ptrdiff_t mjson_scan(const char *s, ptrdiff_t i, ptrdiff_t len,
+                            const char *set, int n, int neg) {
+  int k;
+#if MJSON_ENABLE_SIMD
+#if MJSON_AVX2
+  if (len - i >= 32 && mjson_has_avx2()) {
+    i = mjson_scan_avx2(s, i, len, set, n, neg);
+  }
+#endif
+  i = mjson_scan_sse2(s, i, len, set, n, neg);
+#else
+  if (!neg) {
+    // Portable SWAR: test a machine word at a time for a zero byte in
+    // (word ^ broadcast(set[k])), then pinpoint the match below
+    size_t lo = (size_t) -1 / 255, hi = lo * 128, w, x, m;
+    for (; i + (ptrdiff_t) sizeof(w) <= len; i += (ptrdiff_t) sizeof(w)) {
+      memcpy(&w, s + i, sizeof(w));
+      for (m = 0, k = 0; k < n; k++) {
+        x = w ^ (lo * (unsigned char) set[k]);
+        m |= (x - lo) & ~x & hi;
+      }
+      if (m != 0) break;
+    }
+  }
+#endif
+  for (; i < len; i++) {
+    for (k = 0; k < n; k++) {
+      if (s[i] == set[k]) break;
+    }
+    if ((k < n) != (neg != 0)) break;
+  }
+  return i;
+}
+
 static int mjson_esc(int c, int esc) {
   const char *p, *esc1 = "\b\f\n\r\t\\\"", *esc2 = "bfnrt\\\"";
   for (p = esc ? esc1 : esc2; *p != '\0'; p++) {
@@ -41,99 +171,344 @@ static int mjson_escape(int c) {
   return mjson_esc(c, 1);
 }
 
-static int mjson_pass_string(const char *s, int len) {
-  int i;
-  for (i = 0; i < len; i++) {
-    if (s[i] == '\\' && i + 1 < len && mjson_escape(s[i + 1])) {
-      i++;
-    } else if (s[i] == '\0') {
-      return MJSON_ERROR_INVALID_INPUT;
-    } else if (s[i] == '"') {
-      return i;
+// Returned by the lexers below when the input ends in the middle of a token
+enum { MJSON_CUT = -100 };
+
+// Returned by a mjson_walk() callback to jump over the container it opens
+enum { MJSON_SKIP = 2 };
+
+#if defined(__GNUC__)
+#define MJSON_NOINLINE __attribute__((noinline))
+#else
+#define MJSON_NOINLINE
+#endif
+
+static ptrdiff_t mjson_pass_string(const char *s, ptrdiff_t len) {
+  ptrdiff_t i = 0;
+  // Most strings are short keys and values: look at their first bytes one
+  // by one, the block scanner only pays off for the strings still open after
+  for (; i < len && i < 16; i++) {
+    if (s[i] == '"') return i;
+    if (s[i] == '\0') return MJSON_ERROR_INVALID_INPUT;
+    if (s[i] == '\\') {
+      if (i + 1 >= len) return MJSON_CUT;
+      if (mjson_escape(s[i + 1])) i++;
+    }
+  }
+  for (;;) {
+    // Jump to the next quote, backslash or NUL, the only bytes that matter
+    i = mjson_scan(s, i, len, "\"\\", 3, 0);
+    if (i >= len) return MJSON_CUT;
+    if (s[i] == '\0') return MJSON_ERROR_INVALID_INPUT;
+    if (s[i] == '"') return i;
+    if (i + 1 >= len) return MJSON_CUT;
+    if (mjson_escape(s[i + 1])) i++;
+    i++;
+  }
+}
+
+#if DBL_MANT_DIG == 53 && \
+    ((defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0) || defined(_M_X64))
+#define MJSON_FAST_DBL 1
+#else
+#define MJSON_FAST_DBL 0
+#endif
+
+static int mjson_isdigit(int c) {
+  return c >= '0' && c <= '9';
+}
+
+// Strict JSON number lexer: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][-+]?[0-9]+)?
+// Return the length of the number that starts at s, 0 if it is malformed,
+// or MJSON_CUT if it stops short at len. If v is not NULL, store the
+// number's value there.
+static ptrdiff_t mjson_pass_number(const char *s, ptrdiff_t len, double *v) {
+  ptrdiff_t i = 0, ndigits = 0, e10 = 0;
+  int e = 0, esign = 1;
+  double m = 0;
+  if (i < len && s[i] == '-') i++;
+  if (i >= len) return MJSON_CUT;
+  if (!mjson_isdigit(s[i])) return 0;
+  if (s[i] == '0') {
+    if (++i < len && mjson_isdigit(s[i])) return 0;  // No leading zeros
+  } else {
+    for (; i < len && mjson_isdigit(s[i]); i++, ndigits++) {
+      m = m * 10 + (s[i] - '0');
+    }
+  }
+  if (i < len && s[i] == '.') {
+    if (++i >= len) return MJSON_CUT;
+    if (!mjson_isdigit(s[i])) return 0;
+    for (; i < len && mjson_isdigit(s[i]); i++, ndigits++, e10--) {
+      m = m * 10 + (s[i] - '0');
+    }
+  }
+  if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+    if (++i < len && (s[i] == '-' || s[i] == '+')) {
+      if (s[i++] == '-') esign = -1;
+    }
+    if (i >= len) return MJSON_CUT;
+    if (!mjson_isdigit(s[i])) return 0;
+    for (; i < len && mjson_isdigit(s[i]); i++) {
+      if (e < 10000) e = e * 10 + (s[i] - '0');
+    }
+    e10 += e * esign;
+  }
+  if (v != NULL) {
+#if MJSON_FAST_DBL
+    // Up to 15 digits are exact in a double, and so are 1e0 .. 1e22. One
+    // multiplication or division of two exact values is correctly rounded.
+    static const double p10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+    if (ndigits <= 15 && e10 >= -22 && e10 <= 22) {
+      m = e10 < 0 ? m / p10[-e10] : m * p10[e10];
+      *v = s[0] == '-' ? -m : m;
+    } else
+#endif
+    {
+      *v = strtod(s, NULL);
+    }
+  }
+  return i;
+}
+
+enum { S_VALUE, S_KEY, S_COLON, S_COMMA_OR_EOO, S_DONE };
+
+// Open containers are stacked one bit per level: 1 for '{', 0 for '['
+static void mjson_push(unsigned char *stack, int depth, int c) {
+  unsigned char bit = (unsigned char) (1 << (depth & 7));
+  if (c == '{') {
+    stack[depth >> 3] |= bit;
+  } else {
+    stack[depth >> 3] &= (unsigned char) ~bit;
+  }
+}
+
+// Return the offset of the bracket that closes the container that opens at
+// s[i], or a negative error. Only brackets and strings are looked at, what
+// is in between is not validated.
+static ptrdiff_t mjson_skip(const char *s, ptrdiff_t i, ptrdiff_t len) {
+  ptrdiff_t end, depth = 0;
+  int instr = 0;
+  while (i < len) {
+#if MJSON_ENABLE_SIMD
+    if (i + 16 <= len) {
+      // Quotes toggle the in-string state, so a prefix XOR of the quote
+      // mask marks string contents. Escapes are left to the scalar loop.
+      __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+#define MJSON_MASK(c) \
+  ((unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))))
+      if (MJSON_MASK('\\') == 0) {
+        unsigned str = MJSON_MASK('"'), om, cm, m;
+        str ^= str << 1, str ^= str << 2, str ^= str << 4, str ^= str << 8;
+        str = (instr ? ~str : str) & 0xffff;
+        instr = (int) (str >> 15);
+        om = (MJSON_MASK('[') | MJSON_MASK('{')) & ~str;
+        cm = (MJSON_MASK(']') | MJSON_MASK('}')) & ~str;
+        for (m = om | cm; m != 0; m &= m - 1) {
+          unsigned bit = m & (0U - m);
+          if (om & bit) {
+            depth++;
+          } else if (--depth == 0) {
+            return i + mjson_ctz(bit);
+          }
+        }
+        i += 16;
+        continue;
+      }
+#undef MJSON_MASK
+    }
+#endif
+    for (end = i + 16; i < end && i < len; i++) {
+      char c = s[i];
+      if (instr) {
+        if (c == '\\') i++;
+        if (c == '"') instr = 0;
+      } else if (c == '"') {
+        instr = 1;
+      } else if (c == '[' || c == '{') {
+        depth++;
+      } else if ((c == ']' || c == '}') && --depth == 0) {
+        return i;
+      }
     }
   }
   return MJSON_ERROR_INVALID_INPUT;
 }
 
-int mjson(const char *s, int len, mjson_cb_t cb, void *ud) {
-  enum { S_VALUE, S_KEY, S_COLON, S_COMMA_OR_EOO } expecting = S_VALUE;
-  unsigned char nesting[MJSON_MAX_DEPTH];
-  int i, depth = 0;
-#define MJSONCALL(ev) \
-  if (cb != NULL && cb(ev, s, start, i - start + 1, ud)) return i + 1;
+// Where mjson_run() passes tokens to: either of the callbacks, as they are
+// found. If `walk` is set, the callback may return MJSON_SKIP for an opening
+// bracket: the container's contents are then jumped over, and the callback
+// is called next for its closing bracket.
+struct mjson_sink {
+  mjson_cb_t cb;
+  mjson_cb64_t cb64;
+  void *ud;
+  int walk;
+};
+
+static int mjson_emit(const struct mjson_sink *sk, int tok, const char *s,
+                      ptrdiff_t off, ptrdiff_t len) {
+  return sk->cb64 != NULL ? sk->cb64(tok, s, off, len, sk->ud)
+         : sk->cb != NULL ? sk->cb(tok, s, (int) off, (int) len, sk->ud)
+                          : 0;
+}
+
+static int mjson_top(const unsigned char *stack, int depth) {
+  return (stack[(depth - 1) >> 3] >> ((depth - 1) & 7)) & 1 ? '{' : '[';
+}
+
+// Run the state machine over s[st->pos..len), passing every token to `sk`,
+// or else storing up to `cap` tokens into `out`, and their number into
+// *ntoks. If both are NULL, only validate. If `brk` is set, stop after an
+// opening bracket, too. Return the document length once the top-level value
+// is complete, or a negative error code; st->pos is then the offset where
+// the error was found. Return the end of the token the callback stopped at,
+// if it did. Return 0 if `out` is full or the input ends first: st->pos is
+// then where to resume, which is the start of a token that is cut short, if
+// any. Unless eof is set, a token that reaches len is treated as cut short,
+// because it may continue in the next chunk.
+static ptrdiff_t mjson_run(struct mjson_state *st, const char *s,
+                           ptrdiff_t len, int eof,
+                           const struct mjson_sink *sk,
+                           struct mjson_token *out, int cap, int brk,
+                           int *ntoks) {
+  ptrdiff_t i, res = 0;
+  int n = 0, r = 0, expecting = st->expecting, depth = st->depth;
+  unsigned char *nesting = st->stack ? st->stack : st->nesting;
+  int maxdepth = st->stack ? st->maxdepth : MJSON_MAX_DEPTH;
+#define MJSONRET(x) \
+  do {              \
+    res = (x);      \
+    goto done;      \
+  } while (0)
+// A callback that stops makes the return value, unless it skips a container
+#define MJSONTOK(ev)                                                     \
+  do {                                                                   \
+    if (sk != NULL) {                                                    \
+      r = mjson_emit(sk, (ev), s, start, i - start + 1);                 \
+      if (r != 0 && (r != MJSON_SKIP || !sk->walk ||                     \
+                     (c != '{' && c != '['))) {                          \
+        i++;                                                             \
+        MJSONRET(i);                                                     \
+      }                                                                  \
+    } else if (out != NULL) {                                            \
+      out[n].type = (ev);                                                \
+      out[n].off = start;                                                \
+      out[n].len = i - start + 1;                                        \
+      n++;                                                               \
+    }                                                                    \
+  } while (0)
+#define MJSONDONE()        \
+  do {                     \
+    expecting = S_DONE;    \
+    i++;                   \
+    MJSONRET(i);           \
+  } while (0)
 
 // In the ascii table, the distance between `[` and `]` is 2.
 // Ditto for `{` and `}`. Hence +2 in the code below.
-#define MJSONEOO()                                                     \
-  do {                                                                 \
-    if (c != nesting[depth - 1] + 2) return MJSON_ERROR_INVALID_INPUT; \
-    depth--;                                                           \
-    if (depth == 0) {                                                  \
-      MJSONCALL(tok);                                                  \
-      return i + 1;                                                    \
-    }                                                                  \
+#define MJSONEOO()                                                       \
+  do {                                                                   \
+    if (c != mjson_top(nesting, depth) + 2) {                            \
+      MJSONRET(MJSON_ERROR_INVALID_INPUT);                               \
+    }                                                                    \
+    depth--;                                                             \
+    if (depth == 0) {                                                    \
+      MJSONTOK(tok);                                                     \
+      MJSONDONE();                                                       \
+    }                                                                    \
   } while (0)
 
-  for (i = 0; i < len; i++) {
-    int start = i;
+// Handle a token that stops short at len: an error at the end of input,
+// otherwise rewind to its start and wait for more data
+#define MJSONCUT()                                   \
+  do {                                               \
+    if (eof) MJSONRET(MJSON_ERROR_INVALID_INPUT);    \
+    i = start;                                       \
+    MJSONRET(0);                                     \
+  } while (0)
+
+  *ntoks = 0;
+  if (expecting == S_DONE) return st->pos;
+  for (i = st->pos; i < len; i++) {
+    ptrdiff_t start = i;
     unsigned char c = ((unsigned char *) s)[i];
     int tok = c;
-    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') continue;
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      // Runs are mostly a few bytes of indentation: step over those, and
+      // scan straight to the next token only from the 8th byte on
+      ptrdiff_t end = i + 8 < len ? i + 8 : len;
+      for (i++; i < end; i++) {
+        char w = s[i];
+        if (w != ' ' && w != '\t' && w != '\n' && w != '\r') break;
+      }
+      if (i == end && i < len) i = mjson_scan(s, i, len, " \t\n\r", 4, 1);
+      i--;
+      continue;
+    }
     // printf("- %c [%.*s] %d %d\n", c, i, s, depth, expecting);
     switch (expecting) {
       case S_VALUE:
         if (c == '{') {
-          if (depth >= (int) sizeof(nesting)) return MJSON_ERROR_TOO_DEEP;
-          nesting[depth++] = c;
+          if (depth >= maxdepth) MJSONRET(MJSON_ERROR_TOO_DEEP);
+          mjson_push(nesting, depth++, c);
           expecting = S_KEY;
           break;
         } else if (c == '[') {
-          if (depth >= (int) sizeof(nesting)) return MJSON_ERROR_TOO_DEEP;
-          nesting[depth++] = c;
+          if (depth >= maxdepth) MJSONRET(MJSON_ERROR_TOO_DEEP);
+          mjson_push(nesting, depth++, c);
           break;
         } else if (c == ']' && depth > 0) {  // Empty array
           MJSONEOO();
-        } else if (c == 't' && i + 3 < len && memcmp(&s[i], "true", 4) == 0) {
-          i += 3;
-          tok = MJSON_TOK_TRUE;
-        } else if (c == 'n' && i + 3 < len && memcmp(&s[i], "null", 4) == 0) {
-          i += 3;
-          tok = MJSON_TOK_NULL;
-        } else if (c == 'f' && i + 4 < len && memcmp(&s[i], "false", 5) == 0) {
-          i += 4;
-          tok = MJSON_TOK_FALSE;
+        } else if (c == 't' || c == 'f' || c == 'n') {
+          const char *lit = c == 't' ? "true" : c == 'f' ? "false" : "null";
+          ptrdiff_t k = c == 'f' ? 5 : 4;
+          if (len - i < k) {
+            if (memcmp(&s[i], lit, len - i) == 0) MJSONCUT();
+            MJSONRET(MJSON_ERROR_INVALID_INPUT);
+          }
+          if (memcmp(&s[i], lit, k) != 0) MJSONRET(MJSON_ERROR_INVALID_INPUT);
+          i += k - 1;
+          tok = c == 't' ? MJSON_TOK_TRUE
+                         : c == 'f' ? MJSON_TOK_FALSE : MJSON_TOK_NULL;
         } else if (c == '-' || ((c >= '0' && c <= '9'))) {
-          char *end = NULL;
-          strtod(&s[i], &end);
-          if (end != NULL) i += (int) (end - &s[i] - 1);
+          ptrdiff_t k = mjson_pass_number(&s[i], len - i, NULL);
+          if (k == MJSON_CUT || (!eof && i + k == len)) MJSONCUT();
+          if (k == 0) MJSONRET(MJSON_ERROR_INVALID_INPUT);
+          i += k - 1;
           tok = MJSON_TOK_NUMBER;
         } else if (c == '"') {
-          int n = mjson_pass_string(&s[i + 1], len - i - 1);
-          if (n < 0) return n;
-          i += n + 1;
+          ptrdiff_t k = mjson_pass_string(&s[i + 1], len - i - 1);
+          if (k == MJSON_CUT) MJSONCUT();
+          if (k < 0) MJSONRET(k);
+          i += k + 1;
           tok = MJSON_TOK_STRING;
         } else {
-          return MJSON_ERROR_INVALID_INPUT;
+          MJSONRET(MJSON_ERROR_INVALID_INPUT);
         }
         if (depth == 0) {
-          MJSONCALL(tok);
-          return i + 1;
+          MJSONTOK(tok);
+          MJSONDONE();
         }
         expecting = S_COMMA_OR_EOO;
         break;
 
       case S_KEY:
         if (c == '"') {
-          int n = mjson_pass_string(&s[i + 1], len - i - 1);
-          if (n < 0) return n;
-          i += n + 1;
+          ptrdiff_t k = mjson_pass_string(&s[i + 1], len - i - 1);
+          if (k == MJSON_CUT) MJSONCUT();
+          if (k < 0) MJSONRET(k);
+          i += k + 1;
           tok = MJSON_TOK_KEY;
           expecting = S_COLON;
         } else if (c == '}') {  // Empty object
           MJSONEOO();
           expecting = S_COMMA_OR_EOO;
         } else {
-          return MJSON_ERROR_INVALID_INPUT;
+          MJSONRET(MJSON_ERROR_INVALID_INPUT);
         }
         break;
 
@@ -141,96 +516,837 @@ int mjson(const char *s, int len, mjson_cb_t cb, void *ud) {
         if (c == ':') {
           expecting = S_VALUE;
         } else {
-          return MJSON_ERROR_INVALID_INPUT;
+          MJSONRET(MJSON_ERROR_INVALID_INPUT);
         }
         break;
 
       case S_COMMA_OR_EOO:
-        if (depth <= 0) return MJSON_ERROR_INVALID_INPUT;
+        if (depth <= 0) MJSONRET(MJSON_ERROR_INVALID_INPUT);
         if (c == ',') {
-          expecting = (nesting[depth - 1] == '{') ? S_KEY : S_VALUE;
+          expecting = mjson_top(nesting, depth) == '{' ? S_KEY : S_VALUE;
         } else if (c == ']' || c == '}') {
           MJSONEOO();
         } else {
-          return MJSON_ERROR_INVALID_INPUT;
+          MJSONRET(MJSON_ERROR_INVALID_INPUT);
         }
         break;
     }
-    MJSONCALL(tok);
+    MJSONTOK(tok);
+    if (r != 0) {
+      // MJSON_SKIP for the bracket at i: jump to its pair, and report that
+      ptrdiff_t end = mjson_skip(s, i, len);
+      if (end < 0) MJSONRET(end);
+      depth--, i = end, r = 0;
+      expecting = depth == 0 ? S_DONE : S_COMMA_OR_EOO;
+      if (mjson_emit(sk, c + 2, s, end, 1) || depth == 0) {
+        i++;
+        MJSONRET(i);
+      }
+      continue;
+    }
+    if (out != NULL && (n >= cap || (brk && (c == '{' || c == '[')))) {
+      i++;
+      MJSONRET(0);
+    }
   }
-  return MJSON_ERROR_INVALID_INPUT;
+  if (eof) MJSONRET(MJSON_ERROR_INVALID_INPUT);
+
+done:
+  st->expecting = expecting;
+  st->depth = depth;
+  st->pos = i;
+  *ntoks = n;
+  return res;
+}
+
+// Pass every token of s[st->pos..len) to either of the callbacks. Return
+// like mjson_run()
+static ptrdiff_t mjson_dispatch(struct mjson_state *st, const char *s,
+                                ptrdiff_t len, int eof, mjson_cb_t cb,
+                                mjson_cb64_t cb64, void *ud) {
+  struct mjson_sink sk;
+  int n;
+  sk.cb = cb, sk.cb64 = cb64, sk.ud = ud, sk.walk = 0;
+  return mjson_run(st, s, len, eof, cb == NULL && cb64 == NULL ? NULL : &sk,
+                   NULL, 0, 0, &n);
+}
+
+int mjson(const char *s, int len, mjson_cb_t cb, void *ud) {
+  return mjson_deep(s, len, cb, ud, NULL, 0);
+}
+
+int mjson_deep(const char *s, int len, mjson_cb_t cb, void *ud,
+               unsigned char *stack, int size) {
+  struct mjson_state st;
+  memset(&st, 0, sizeof(st));
+  st.stack = stack, st.maxdepth = size * 8;
+  return (int) mjson_dispatch(&st, s, len, 1, cb, NULL, ud);
+}
+
+ptrdiff_t mjson64(const char *s, ptrdiff_t len, mjson_cb64_t cb, void *ud) {
+  struct mjson_state st;
+  memset(&st, 0, sizeof(st));
+  return mjson_dispatch(&st, s, len, 1, NULL, cb, ud);
+}
+
+// Same as mjson64(), but start parsing at offset `start`, and let the
+// callback return MJSON_SKIP for an opening bracket, see struct mjson_sink
+static ptrdiff_t mjson_walk(const char *s, ptrdiff_t start, ptrdiff_t len,
+                            mjson_cb64_t cb, void *ud) {
+  struct mjson_state st;
+  struct mjson_sink sk;
+  int n;
+  memset(&st, 0, sizeof(st));
+  st.pos = start;
+  sk.cb = NULL, sk.cb64 = cb, sk.ud = ud, sk.walk = 1;
+  return mjson_run(&st, s, len, 1, &sk, NULL, 0, 0, &n);
+}
+
+int mjson_tokenize_ex(const char *s, ptrdiff_t len, struct mjson_token *out,
+                      int cap, struct mjson_state *st, int flags) {
+  int n = 0, k = 0;
+  ptrdiff_t res;
+  if (flags & MJSON_TOKENIZE_SKIP) {
+    // Same as mjson_walk(): jump past the closing bracket, and report it
+    ptrdiff_t open = st->pos - 1;
+    if (open < 0 || (s[open] != '{' && s[open] != '[') ||
+        st->expecting == S_DONE || cap < 1) {
+      return MJSON_ERROR_INVALID_INPUT;
+    }
+    if ((res = mjson_skip(s, open, len)) < 0) return (int) res;
+    st->pos = res + 1;
+    st->expecting = --st->depth == 0 ? S_DONE : S_COMMA_OR_EOO;
+    out[0].type = s[open] + 2, out[0].off = res, out[0].len = 1;
+    if (cap == 1) return 1;
+    out++, cap--, n = 1;
+  }
+  res = mjson_run(st, s, len, 1, NULL, out, cap, flags & MJSON_TOKENIZE_BRK,
+                  &k);
+  n += k;
+  // Tokens that precede an error go first, the next call reports the error
+  return n > 0 ? n : res < 0 ? (int) res : 0;
+}
+
+int mjson_tokenize(const char *s, ptrdiff_t len, struct mjson_token *out,
+                   int cap, struct mjson_state *st) {
+  return mjson_tokenize_ex(s, len, out, cap, st, 0);
+}
+
+// Return the offset of the first byte in s[i..len) that is not ASCII
+static ptrdiff_t mjson_skip_ascii(const char *s, ptrdiff_t i, ptrdiff_t len) {
+#if MJSON_ENABLE_SIMD
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    unsigned bits = (unsigned) _mm_movemask_epi8(v);
+    if (bits) return i + mjson_ctz(bits);
+  }
+#else
+  size_t hi = (size_t) -1 / 255 * 128, w;
+  for (; i + (ptrdiff_t) sizeof(w) <= len; i += (ptrdiff_t) sizeof(w)) {
+    memcpy(&w, s + i, sizeof(w));
+    if (w & hi) break;
+  }
+#endif
+  while (i < len && (signed char) s[i] >= 0) i++;
+  return i;
+}
+
+// Return the offset of the first byte in s[i..len) that does not start a
+// well-formed UTF-8 sequence, or len. Overlong forms, surrogates and code
+// points above U+10FFFF are rejected, as RFC 3629 requires.
+static ptrdiff_t mjson_utf8_scalar(const char *s, ptrdiff_t i, ptrdiff_t len) {
+  const unsigned char *u = (const unsigned char *) s;
+  while ((i = mjson_skip_ascii(s, i, len)) < len) {
+    unsigned char c = u[i], lo = 0x80, hi = 0xbf;
+    int k, n;
+    if (c >= 0xc2 && c <= 0xdf) {
+      n = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      n = 2;
+      if (c == 0xe0) lo = 0xa0;  // Overlong
+      if (c == 0xed) hi = 0x9f;  // Surrogate
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      n = 3;
+      if (c == 0xf0) lo = 0x90;  // Overlong
+      if (c == 0xf4) hi = 0x8f;  // Above U+10FFFF
+    } else {
+      return i;
+    }
+    if (len - i <= n || u[i + 1] < lo || u[i + 1] > hi) return i;
+    for (k = 2; k <= n; k++) {
+      if ((u[i + k] & 0xc0) != 0x80) return i;
+    }
+    i += n + 1;
+  }
+  return i;
+}
+
+#if MJSON_AVX2
+// Keiser & Lemire, "Validating UTF-8 in less than one instruction per byte".
+// Every byte is classified by three 16-entry lookups on the high and low
+// nibbles of the previous byte and the high nibble of itself; the AND of
+// the three is non-zero for any malformed 2-byte pattern. Longer sequences
+// are checked by matching continuation bytes against 3- and 4-byte leads.
+// Return the offset of the first 32-byte block that holds an error, or the
+// end of the last block; either way, everything before it is valid except
+// possibly a sequence that crosses into the block.
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static ptrdiff_t mjson_utf8_avx2(const char *s, ptrdiff_t len) {
+  enum {
+    SHORT = 1, LONG = 2, OVER3 = 4, LARGE = 8, SURR = 16, OVER2 = 32,
+    L1000 = 64, OVER4 = 64, CONT2 = 128, CARRY = SHORT | LONG | CONT2
+  };
+  // Flags go up to 0x80, cast them so that they don't overflow a char
+#define MJSON_C(x) ((char) (x))
+#define MJSON_T16(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p)             \
+  _mm256_setr_epi8(                                                          \
+      MJSON_C(a), MJSON_C(b), MJSON_C(c), MJSON_C(d), MJSON_C(e), MJSON_C(f), \
+      MJSON_C(g), MJSON_C(h), MJSON_C(i), MJSON_C(j), MJSON_C(k), MJSON_C(l), \
+      MJSON_C(m), MJSON_C(n), MJSON_C(o), MJSON_C(p), MJSON_C(a), MJSON_C(b), \
+      MJSON_C(c), MJSON_C(d), MJSON_C(e), MJSON_C(f), MJSON_C(g), MJSON_C(h), \
+      MJSON_C(i), MJSON_C(j), MJSON_C(k), MJSON_C(l), MJSON_C(m), MJSON_C(n), \
+      MJSON_C(o), MJSON_C(p))
+  const __m256i t1 = MJSON_T16(
+      LONG, LONG, LONG, LONG, LONG, LONG, LONG, LONG, CONT2, CONT2, CONT2,
+      CONT2, SHORT | OVER2, SHORT, SHORT | OVER3 | SURR,
+      SHORT | LARGE | L1000 | OVER4);
+  const __m256i t2 = MJSON_T16(
+      CARRY | OVER3 | OVER2 | OVER4, CARRY | OVER2, CARRY, CARRY,
+      CARRY | LARGE, CARRY | LARGE | L1000, CARRY | LARGE | L1000,
+      CARRY | LARGE | L1000, CARRY | LARGE | L1000, CARRY | LARGE | L1000,
+      CARRY | LARGE | L1000, CARRY | LARGE | L1000, CARRY | LARGE | L1000,
+      CARRY | LARGE | L1000 | SURR, CARRY | LARGE | L1000,
+      CARRY | LARGE | L1000);
+  const __m256i t3 = MJSON_T16(
+      SHORT, SHORT, SHORT, SHORT, SHORT, SHORT, SHORT, SHORT,
+      LONG | OVER2 | CONT2 | OVER3 | L1000 | OVER4,
+      LONG | OVER2 | CONT2 | OVER3 | LARGE,
+      LONG | OVER2 | CONT2 | SURR | LARGE, LONG | OVER2 | CONT2 | SURR | LARGE,
+      SHORT, SHORT, SHORT, SHORT);
+#undef MJSON_T16
+#undef MJSON_C
+  const __m256i nib = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+  // A lead byte in the last 1..3 positions needs more bytes in the next block
+  const __m256i maxv = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char) 0xef, (char) 0xdf,
+      (char) 0xbf);
+  __m256i prev = zero, incomplete = zero;
+  ptrdiff_t i;
+  for (i = 0; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i)), err;
+    if (_mm256_movemask_epi8(v) == 0) {
+      err = incomplete;  // All ASCII, unless a sequence was left open
+    } else {
+      __m256i p = _mm256_permute2x128_si256(prev, v, 0x21);
+      __m256i p1 = _mm256_alignr_epi8(v, p, 15);
+      __m256i p2 = _mm256_alignr_epi8(v, p, 14);
+      __m256i p3 = _mm256_alignr_epi8(v, p, 13);
+      __m256i b1h = _mm256_shuffle_epi8(
+          t1, _mm256_and_si256(_mm256_srli_epi16(p1, 4), nib));
+      __m256i b1l = _mm256_shuffle_epi8(t2, _mm256_and_si256(p1, nib));
+      __m256i b2h = _mm256_shuffle_epi8(
+          t3, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+      __m256i sc = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+      __m256i third = _mm256_subs_epu8(p2, _mm256_set1_epi8((char) 0xdf));
+      __m256i fourth = _mm256_subs_epu8(p3, _mm256_set1_epi8((char) 0xef));
+      __m256i must = _mm256_cmpgt_epi8(_mm256_or_si256(third, fourth), zero);
+      must = _mm256_and_si256(must, _mm256_set1_epi8((char) 0x80));
+      err = _mm256_xor_si256(must, sc);
+      incomplete = _mm256_subs_epu8(v, maxv);
+    }
+    if (!_mm256_testz_si256(err, err)) break;
+    prev = v;
+  }
+  return i;
+}
+#endif  // MJSON_AVX2
+
+// Return the offset of the first byte in s[0..len) that does not start a
+// well-formed UTF-8 sequence, or len
+static ptrdiff_t mjson_utf8(const char *s, ptrdiff_t len) {
+  ptrdiff_t i = 0;
+#if MJSON_AVX2
+  if (len >= 64 && mjson_has_avx2()) {
+    // Step back to the start of the sequence, if any, that crosses into
+    // the block where the vector loop stopped
+    ptrdiff_t stop = mjson_utf8_avx2(s, len);
+    i = stop < 3 ? 0 : stop - 3;
+    while (i < stop && (s[i] & 0xc0) == 0x80) i++;
+  }
+#endif
+  return mjson_utf8_scalar(s, i, len);
 }
 
-struct msjon_get_data {
-  const char *path;     // Lookup json path
-  int pos;              // Current path index
-  int d1;               // Current depth of traversal
-  int d2;               // Expected depth of traversal
-  int i1;               // Index in an array
-  int i2;               // Expected index in an array
-  int obj;              // If the value is array/object, offset where it starts
+int mjson_validate(const char *s, int len, int *erroff) {
+  struct mjson_state st;
+  ptrdiff_t res, end, bad;
+  int n;
+  memset(&st, 0, sizeof(st));
+  res = mjson_run(&st, s, len, 1, NULL, NULL, 0, 0, &n);
+  // Non-ASCII bytes are legal only inside strings, so it is enough to check
+  // the valid part of the document; an earlier UTF-8 error takes precedence
+  end = res > 0 ? res : st.pos;
+  bad = mjson_utf8(s, end);
+  if (bad < end) res = MJSON_ERROR_INVALID_INPUT, st.pos = bad;
+  if (res < 0 && erroff != NULL) *erroff = (int) st.pos;
+  return (int) res;
+}
+
+void mjson_stream_init(struct mjson_stream *st, char *buf, int size,
+                       mjson_cb_t cb, void *ud) {
+  memset(st, 0, sizeof(*st));
+  st->buf = buf;
+  st->size = size;
+  st->cb = cb;
+  st->ud = ud;
+}
+
+int mjson_stream_feed(struct mjson_stream *st, const char *s, int n) {
+  int res, base = st->total, eof = n <= 0;
+  if (st->result != 0) return st->result;
+  if (n < 0) n = 0;
+  st->total += n;
+  st->state.pos = 0;
+  if (st->len > 0) {
+    // A token is cut in two. Glue its head and as much of the new chunk as
+    // fits in the buffer, and parse from there until the token is complete
+    int had = st->len, k = st->size - st->len < n ? st->size - st->len : n;
+    if (k > 0) memcpy(st->buf + st->len, s, k);  // s is NULL at the end
+    st->len += k;
+    res = (int) mjson_dispatch(&st->state, st->buf, st->len, eof, st->cb,
+                               NULL, st->ud);
+    if (res != 0) return st->result = res > 0 ? base - had + res : res;
+    if (st->state.pos == 0) {
+      if (k < n) return st->result = MJSON_ERROR_TOO_LONG;
+      return 0;  // Still incomplete, and the whole chunk is buffered
+    }
+    st->state.pos -= had;  // Carry on from the chunk itself
+    st->len = 0;
+  }
+  res = (int) mjson_dispatch(&st->state, s, n, eof, st->cb, NULL, st->ud);
+  if (res != 0) return st->result = res > 0 ? base + res : res;
+  if (n - st->state.pos > st->size) return st->result = MJSON_ERROR_TOO_LONG;
+  // Keep the cut-off token for the next call
+  st->len = (int) (n - st->state.pos);
+  if (st->len > 0) memcpy(st->buf, s + st->state.pos, st->len);
+  return 0;
+}
+
+static int mjson_plen(const char *s) {
+  int i = 0;
+  while (s[i] != '\0' && s[i] != '.' && s[i] != '[') i++;
+  return i;
+}
+
+// Parse an array index at p into *v, return the number of digits
+static int mjson_path_index(const char *p, int *v) {
+  int i;
+  for (*v = 0, i = 0; mjson_isdigit(p[i]); i++) {
+    if (*v > (INT_MAX - 9) / 10) return -1;
+    *v = *v * 10 + (p[i] - '0');
+  }
+  return i;
+}
+
+static const char *mjson_path_ws(const char *p) {
+  while (*p == ' ') p++;
+  return p;
+}
+
+// Parse filter term "@.key.key OP literal" at *pp into a new term
+static int mjson_path_term(const char **pp, struct mjson_path *cp, int or_) {
+  const char *p = mjson_path_ws(*pp);
+  struct mjson_path_term *t = &cp->terms[cp->nterms];
+  if (*p++ != '@') return MJSON_ERROR_INVALID_INPUT;
+  if (cp->nterms >= MJSON_PATH_TERMS) return MJSON_ERROR_TOO_LONG;
+  memset(t, 0, sizeof(*t));
+  t->or_ = or_;
+  if (*p == '.') {
+    for (t->key = ++p; *p != '\0' && strchr(" =!<>&|)[", *p) == NULL;) p++;
+    t->klen = (int) (p - t->key);
+    if (t->klen == 0 || p[-1] == '.') return MJSON_ERROR_INVALID_INPUT;
+  }
+  p = mjson_path_ws(p);
+  if ((p[0] == '=' || p[0] == '!' || p[0] == '<' || p[0] == '>') &&
+      p[1] == '=') {
+    t->op = p[0] == '<' ? 'l' : p[0] == '>' ? 'g' : p[0];
+    p += 2;
+  } else if (p[0] == '<' || p[0] == '>') {
+    t->op = *p++;
+  } else {
+    *pp = p;
+    return 0;  // Existence test
+  }
+  p = mjson_path_ws(p);
+  if (*p == '\'' || *p == '"') {
+    char quote = *p++;
+    t->tok = MJSON_TOK_STRING;
+    for (t->val = p; *p != quote; p++) {
+      if (*p == '\0') return MJSON_ERROR_INVALID_INPUT;
+    }
+    t->vlen = (int) (p++ - t->val);
+  } else if (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0) {
+    t->tok = *p == 't' ? MJSON_TOK_TRUE : MJSON_TOK_NULL;
+    p += 4;
+  } else if (strncmp(p, "false", 5) == 0) {
+    t->tok = MJSON_TOK_FALSE;
+    p += 5;
+  } else {
+    ptrdiff_t k = mjson_pass_number(p, (ptrdiff_t) strlen(p), &t->num);
+    if (k <= 0) return MJSON_ERROR_INVALID_INPUT;
+    t->tok = MJSON_TOK_NUMBER;
+    p += k;
+  }
+  // Only numbers can be ordered
+  if (t->op != '=' && t->op != '!' && t->tok != MJSON_TOK_NUMBER) {
+    return MJSON_ERROR_INVALID_INPUT;
+  }
+  *pp = p;
+  return 0;
+}
+
+int mjson_path_compile(const char *path, struct mjson_path *cp) {
+  const char *p = path;
+  int k;
+  cp->n = cp->nterms = 0;
+  if (*p++ != '$') return MJSON_ERROR_INVALID_INPUT;
+  while (*p != '\0') {
+    struct mjson_path_seg *seg = &cp->segs[cp->n];
+    // A path deeper than the parser's nesting limit can never match
+    if (cp->n >= MJSON_MAX_DEPTH) return MJSON_ERROR_TOO_DEEP;
+    seg->key = NULL, seg->len = 0, seg->end = INT_MAX, seg->flags = 0;
+    if (p[0] == '.' && p[1] == '.') {
+      seg->flags = MJSON_PATH_DEEP;  // "..key", "..*", "..[N]"
+      p += p[2] == '[' ? 2 : 1;
+    }
+    if (*p == '.' && p[1] == '*' && (p[2] == '\0' || p[2] == '.' ||
+                                     p[2] == '[')) {
+      seg->flags |= MJSON_PATH_ANY;
+      p += 2;
+    } else if (*p == '.') {
+      seg->key = ++p;
+      seg->len = mjson_plen(p);
+      p += seg->len;
+    } else if (*p == '[' && p[1] == '*' && p[2] == ']') {
+      seg->flags |= MJSON_PATH_ANY;
+      p += 3;
+    } else if (*p == '[' && p[1] == '?' && p[2] == '(') {
+      // One filter per path: terms joined by && and ||, && binds tighter
+      int or_ = 0;
+      if (seg->flags != 0 || cp->nterms > 0) return MJSON_ERROR_INVALID_INPUT;
+      seg->flags = MJSON_PATH_FILTER;
+      for (p += 3;; or_ = p[-1] == '|') {
+        if ((k = mjson_path_term(&p, cp, or_)) < 0) return k;
+        cp->nterms++;
+        p = mjson_path_ws(p);
+        if ((p[0] != '&' && p[0] != '|') || p[1] != p[0]) break;
+        p += 2;
+      }
+      if (*p++ != ')' || *p++ != ']') return MJSON_ERROR_INVALID_INPUT;
+    } else if (*p == '[' && (mjson_isdigit(p[1]) || p[1] == ':')) {
+      // "[N]" is the same as the slice "[N:N+1]"
+      if ((k = mjson_path_index(++p, &seg->len)) < 0) {
+        return MJSON_ERROR_INVALID_INPUT;
+      }
+      p += k;
+      if (*p == ':') {
+        if ((k = mjson_path_index(++p, &seg->end)) < 0) {
+          return MJSON_ERROR_INVALID_INPUT;
+        }
+        if (k == 0) seg->end = INT_MAX;
+        p += k;
+      } else if (k == 0 || seg->len == INT_MAX) {
+        return MJSON_ERROR_INVALID_INPUT;
+      } else {
+        seg->end = seg->len + 1;
+      }
+      if (*p++ != ']') return MJSON_ERROR_INVALID_INPUT;
+    } else {
+      return MJSON_ERROR_INVALID_INPUT;
+    }
+    cp->n++;
+  }
+  return cp->n;
+}
+
+// Return non-zero if the path has exact keys and indices only
+static int mjson_path_exact(const struct mjson_path *cp) {
+  int i;
+  for (i = 0; i < cp->n; i++) {
+    const struct mjson_path_seg *seg = &cp->segs[i];
+    if (seg->flags != 0) return 0;
+    if (seg->key == NULL && seg->end != seg->len + 1) return 0;
+  }
+  return 1;
+}
+
+// Evaluate filter term t on value s, len of type tok
+static int mjson_term_eval(const struct mjson_path_term *t, int tok,
+                           const char *s, ptrdiff_t len) {
+  int eq;
+  if (t->op == 0) return 1;  // Exists
+  if (t->tok == MJSON_TOK_NUMBER && tok == MJSON_TOK_NUMBER) {
+    double v = 0;
+    mjson_pass_number(s, len, &v);
+    switch (t->op) {
+      case '<': return v < t->num;
+      case 'l': return v <= t->num;
+      case '>': return v > t->num;
+      case 'g': return v >= t->num;
+    }
+    eq = v == t->num;
+  } else {
+    // Strings are compared as they are, escapes included
+    eq = tok == t->tok && (tok != MJSON_TOK_STRING ||
+                           (len - 2 == t->vlen &&
+                            memcmp(s + 1, t->val, (size_t) t->vlen) == 0));
+  }
+  return t->op == '=' ? eq : t->op == '!' ? !eq : 0;
+}
+
+// Return non-zero if filter terms with results `res` pass
+static int mjson_filter_pass(const struct mjson_path *p, unsigned res) {
+  int i, ok = 1;
+  for (i = 0; i < p->nterms; i++) {
+    if (p->terms[i].or_) {
+      if (ok) return 1;
+      ok = 1;
+    }
+    if (!((res >> i) & 1)) ok = 0;
+  }
+  return ok;
+}
+
+// One open container during a query
+struct mjson_qlevel {
+  unsigned long mask;   // Bit k: children must match segment k next
+  ptrdiff_t start;      // Offset of the opening bracket
+  ptrdiff_t koff;       // Current key, without quotes
+  ptrdiff_t klen;       // Current key length
+  int index;            // Number of children seen
+  int tpos;             // Length of the key chain from the filter candidate
+  unsigned char tmask;  // Bit t: filter term t may match below
+  unsigned char tres;   // Filter candidate: bit t set if term t is true
+  char obj;             // Is an object
+  char match;           // Is a match itself
+};
+
+struct querydata {
+  const struct mjson_path *path;  // Query
+  mjson_cb_t cb;                  // Match callback
+  void *ud;                       // Callback's user data
+  int first;                      // Stop at the first match
+  int stop;                       // Stop requested
+  int filter;                     // Filter segment, or -1
+  int cand;                       // Level of the filter candidate, or 0
+  int depth;                      // Open containers
+  int count;                      // Matches so far
+  int tok;                        // First match
+  ptrdiff_t off, len;             // Ditto
+  unsigned long root;             // States of the root value
+  struct mjson_qlevel levels[MJSON_MAX_DEPTH + 1];
+};
+
+// Given the states `mask` of a container, return the states of its child
+// with the given key, or index if key is NULL. Segment k moves the state
+// from k to k + 1 if it matches the child; recursive segments also stay in
+// state k, to be tried again further down. A filter segment makes the child
+// a candidate, which moves on only once the filter is evaluated.
+static unsigned long mjson_query_step(const struct mjson_path *p,
+                                      unsigned long mask, const char *key,
+                                      ptrdiff_t klen, int index, int *cand) {
+  unsigned long v = 0;
+  int k;
+  for (k = 0; (mask >> k) != 0; k++) {
+    const struct mjson_path_seg *seg = &p->segs[k];
+    if (!((mask >> k) & 1)) continue;
+    if (seg->flags & MJSON_PATH_DEEP) v |= 1UL << k;
+    if (seg->flags & MJSON_PATH_FILTER) {
+      *cand = 1;
+    } else if ((seg->flags & MJSON_PATH_ANY) ||
+               (key == NULL ? seg->key == NULL && index >= seg->len &&
+                                  index < seg->end
+                            : seg->key != NULL && seg->len == klen &&
+                                  memcmp(seg->key, key, (size_t) klen) == 0)) {
+      v |= 1UL << (k + 1);
+    }
+  }
+  return v;
+}
+
+// A value with the given key, inside a filter candidate, starts. Evaluate
+// the filter terms whose key chain ends at it, and return the terms whose
+// chain goes on below it. *tpos is the chain length so far.
+static unsigned mjson_filter_step(struct querydata *q, unsigned tmask,
+                                  const char *key, ptrdiff_t klen, int *tpos,
+                                  int tok, const char *s, ptrdiff_t len) {
+  struct mjson_qlevel *c = &q->levels[q->cand];
+  unsigned res = 0;
+  int i, pos = *tpos == 0 ? 0 : *tpos + 1;
+  for (i = 0; i < q->path->nterms; i++) {
+    const struct mjson_path_term *t = &q->path->terms[i];
+    if (!((tmask >> i) & 1) || pos + klen > t->klen) continue;
+    if (pos > 0 && t->key[pos - 1] != '.') continue;
+    if (memcmp(t->key + pos, key, (size_t) klen) != 0) continue;
+    if (pos + klen == t->klen) {
+      if (mjson_term_eval(t, tok, s, len)) c->tres |= (unsigned char) (1 << i);
+    } else if (t->key[pos + klen] == '.') {
+      res |= 1U << i;
+    }
+  }
+  *tpos = pos + (int) klen;
+  return res;
+}
+
+static int mjson_query_match(struct querydata *q, int tok, const char *s,
+                             ptrdiff_t off, ptrdiff_t len) {
+  if (q->count++ == 0) q->tok = tok, q->off = off, q->len = len;
+  if (q->first || (q->cb != NULL && q->cb(tok, s, (int) off, (int) len,
+                                          q->ud))) {
+    q->stop = 1;
+  }
+  return q->stop;
+}
+
+static ptrdiff_t mjson_query_cp(const char *s, ptrdiff_t start, ptrdiff_t len,
+                                struct querydata *q, unsigned long root);
+
+// A filter candidate that passed is a match if the filter was the last
+// segment. Otherwise, look for the rest of the path inside it
+static MJSON_NOINLINE int mjson_query_rest(struct querydata *q,
+                                           const char *s, ptrdiff_t start,
+                                           ptrdiff_t end, int tok) {
+  struct querydata sub;
+  if (q->filter + 1 == q->path->n) {
+    return mjson_query_match(q, tok, s, start, end - start);
+  }
+  sub.path = q->path, sub.cb = q->cb, sub.ud = q->ud, sub.first = q->first;
+  mjson_query_cp(s, start, end, &sub, 1UL << (q->filter + 1));
+  if (sub.count > 0 && q->count == 0) {
+    q->tok = sub.tok, q->off = sub.off, q->len = sub.len;
+  }
+  q->count += sub.count;
+  q->stop = sub.stop;
+  return q->stop;
+}
+
+static int mjson_query_cb(int tok, const char *s, ptrdiff_t off,
+                          ptrdiff_t len, void *ud) {
+  struct querydata *q = (struct querydata *) ud;
+  struct mjson_qlevel *l = &q->levels[q->depth];
+  unsigned long v, done = 1UL << q->path->n;
+  unsigned tm = 0, tres = 0;
+  int i, cand = 0, tpos = 0;
+  if (tok == MJSON_TOK_KEY) {
+    l->koff = off + 1, l->klen = len - 2;
+  } else if (tok == '}' || tok == ']') {
+    q->depth--;
+    if (l->match && mjson_query_match(q, tok - 2, s, l->start,
+                                      off + 1 - l->start)) {
+      return 1;
+    }
+    if (q->cand == q->depth + 1) {
+      q->cand = 0;
+      if (mjson_filter_pass(q->path, l->tres)) {
+        return mjson_query_rest(q, s, l->start, off + 1, tok - 2);
+      }
+    }
+  } else if (tok == '{' || tok == '[' || MJSON_TOK_IS_VALUE(tok)) {
+    // A value starts. The root is "$" itself, anything else is matched
+    // against the path by its key or index in the parent container
+    const char *key = l->obj ? s + l->koff : NULL;
+    v = q->depth == 0 ? q->root
+                      : mjson_query_step(q->path, l->mask, key, l->klen,
+                                         l->index++, &cand);
+    if (q->cand > 0 && l->tmask != 0 && key != NULL) {
+      tpos = l->tpos;
+      tm = mjson_filter_step(q, l->tmask, key, l->klen, &tpos, tok, s + off,
+                             len);
+    }
+    if (cand && q->cand == 0) {
+      // Terms on "@" itself can be evaluated right away, others below
+      for (i = 0; i < q->path->nterms; i++) {
+        const struct mjson_path_term *t = &q->path->terms[i];
+        if (t->key != NULL) {
+          tm |= 1U << i;
+        } else if (mjson_term_eval(t, tok, s + off, len)) {
+          tres |= 1U << i;
+        }
+      }
+    } else {
+      cand = 0;  // Candidates nested in a candidate are not supported
+    }
+    if (tok == '{' || tok == '[') {
+      l = &q->levels[++q->depth];
+      l->mask = v & ~done, l->start = off, l->index = 0;
+      l->obj = tok == '{', l->match = (v & done) != 0;
+      l->tmask = (unsigned char) tm, l->tpos = tpos;
+      l->tres = (unsigned char) tres;
+      if (cand) q->cand = q->depth;
+      // Nothing inside can match, jump to the closing bracket
+      return l->mask == 0 && tm == 0 ? MJSON_SKIP : 0;
+    }
+    if ((v & done) && mjson_query_match(q, tok, s, off, len)) return 1;
+    if (cand && mjson_filter_pass(q->path, tres)) {
+      return mjson_query_rest(q, s, off, off + len, tok);
+    }
+  }
+  return 0;
+}
+
+static ptrdiff_t mjson_query_cp(const char *s, ptrdiff_t start, ptrdiff_t len,
+                                struct querydata *q, unsigned long root) {
+  int i;
+  q->depth = q->count = q->stop = q->cand = 0, q->filter = -1;
+  q->tok = MJSON_TOK_INVALID, q->root = root;
+  q->levels[0].obj = 0, q->levels[0].tmask = 0;
+  if (q->path->n >= (int) sizeof(unsigned long) * 8) {
+    return MJSON_ERROR_TOO_DEEP;  // States don't fit into the masks
+  }
+  for (i = 0; i < q->path->n; i++) {
+    if (q->path->segs[i].flags & MJSON_PATH_FILTER) q->filter = i;
+  }
+  return mjson_walk(s, start, len, mjson_query_cb, q);
+}
+
+int mjson_query(const char *s, int len, const char *path, mjson_cb_t cb,
+                void *ud) {
+  struct mjson_path cp;
+  struct querydata q;
+  ptrdiff_t res;
+  if (mjson_path_compile(path, &cp) < 0) return MJSON_ERROR_INVALID_INPUT;
+  q.path = &cp, q.cb = cb, q.ud = ud, q.first = 0;
+  res = mjson_query_cp(s, 0, len, &q, 1);
+  return res < 0 ? (int) res : q.count;
+}
+
+struct mjson_get_data {
+  const struct mjson_path *path;  // Compiled path, or NULL to read jp
+  const char *jp;                 // Rest of an exact path string
+  struct mjson_path_seg seg;      // Current path segment
+  int pos;                        // Index of the current segment
+  int end;                        // Whole path matched
+  int d1;                         // Current depth of traversal
+  int d2;                         // Expected depth of traversal
+  int i1;                         // Index in an array
+  int i2;                         // Expected index in an array
+  ptrdiff_t obj;        // If the value is array/object, offset where it starts
   const char **tokptr;  // Destination
-  int *toklen;          // Destination length
+  ptrdiff_t *toklen;    // Destination length
   int tok;              // Returned token
 };
 
-static int mjson_plen(const char *s) {
-  int i = 0;
-  while (s[i] != '\0' && s[i] != '.' && s[i] != '[') i++;
-  return i;
+// Parse one exact segment, ".key" or "[N]", at p into seg. Return its
+// length, or -1 for anything else, which needs mjson_path_compile()
+static int mjson_path_step(const char *p, struct mjson_path_seg *seg) {
+  int k;
+  seg->key = NULL, seg->len = 0, seg->end = INT_MAX, seg->flags = 0;
+  if (p[0] == '.' && p[1] != '.' &&
+      !(p[1] == '*' && (p[2] == '\0' || p[2] == '.' || p[2] == '['))) {
+    seg->key = p + 1;
+    seg->len = mjson_plen(p + 1);
+    return seg->len + 1;
+  }
+  if (p[0] == '[' && mjson_isdigit(p[1])) {
+    k = mjson_path_index(p + 1, &seg->len);
+    if (k < 0 || seg->len == INT_MAX || p[k + 1] != ']') return -1;
+    seg->end = seg->len + 1;
+    return k + 2;
+  }
+  return -1;
+}
+
+// Check that jp is "$" and exact segments only, which mjson_get_cb() can
+// match straight from the string
+static int mjson_path_is_exact(const char *jp) {
+  struct mjson_path_seg seg;
+  int k, n;
+  if (jp[0] != '$') return 0;
+  for (n = 0, jp++; *jp != '\0'; jp += k, n++) {
+    if (n >= MJSON_MAX_DEPTH || (k = mjson_path_step(jp, &seg)) < 0) return 0;
+  }
+  return 1;
+}
+
+// Move on to the next path segment
+static void mjson_get_next(struct mjson_get_data *data) {
+  data->pos++;
+  if (data->path != NULL) {
+    data->end = data->pos >= data->path->n;
+    if (!data->end) data->seg = data->path->segs[data->pos];
+  } else {
+    data->end = *data->jp == '\0';
+    if (!data->end) data->jp += mjson_path_step(data->jp, &data->seg);
+  }
+}
+
+// Start a lookup of either a compiled path, or an exact path string that
+// mjson_path_step() accepts in full, past its "$"
+static void mjson_get_init(struct mjson_get_data *data,
+                           const struct mjson_path *path, const char *jp,
+                           const char **tokptr, ptrdiff_t *toklen) {
+  memset(data, 0, sizeof(*data));
+  data->path = path, data->jp = jp, data->pos = -1, data->obj = -1;
+  data->tokptr = tokptr, data->toklen = toklen, data->tok = MJSON_TOK_INVALID;
+  mjson_get_next(data);
 }
 
-static int mjson_get_cb(int tok, const char *s, int off, int len, void *ud) {
-  struct msjon_get_data *data = (struct msjon_get_data *) ud;
-  // printf("--> %2x %2d %2d %2d %2d\t'%s'\t'%.*s'\t\t'%.*s'\n", tok, data->d1,
-  // data->d2, data->i1, data->i2, data->path + data->pos, off, s, len,
-  // s + off);
+static int mjson_get_cb(int tok, const char *s, ptrdiff_t off, ptrdiff_t len,
+                        void *ud) {
+  struct mjson_get_data *data = (struct mjson_get_data *) ud;
+  const struct mjson_path_seg *seg = &data->seg;
+  int end = data->end;
+  // printf("--> %2x %2d %2d %2d %2d\t%d\t'%.*s'\n", tok, data->d1, data->d2,
+  // data->i1, data->i2, data->pos, (int) len, s + off);
   if (data->tok != MJSON_TOK_INVALID) return 1;  // Found
 
   if (tok == '{') {
-    if (!data->path[data->pos] && data->d1 == data->d2) data->obj = off;
-    data->d1++;
+    if (end && data->d1 == data->d2) data->obj = off;
+    // A container below a non-matching key or index can't hold the target
+    if (data->d1++ > data->d2) return MJSON_SKIP;
   } else if (tok == '[') {
-    if (data->d1 == data->d2 && data->path[data->pos] == '[') {
+    if (data->d1 == data->d2 && !end && seg->key == NULL) {
       data->i1 = 0;
-      data->i2 = (int) strtod(&data->path[data->pos + 1], NULL);
+      data->i2 = seg->len;
       if (data->i1 == data->i2) {
         data->d2++;
-        data->pos += 3;
+        mjson_get_next(data);
       }
     }
-    if (!data->path[data->pos] && data->d1 == data->d2) data->obj = off;
-    data->d1++;
+    if (end && data->d1 == data->d2) data->obj = off;
+    if (data->d1++ > data->d2) return MJSON_SKIP;
   } else if (tok == ',') {
-    if (data->d1 == data->d2 + 1) {
+    if (data->d1 == data->d2) return 1;  // Passed the value on the path
+    if (data->d1 == data->d2 + 1 && !end && seg->key == NULL) {
       data->i1++;
       if (data->i1 == data->i2) {
-        while (data->path[data->pos] != ']') data->pos++;
-        data->pos++;
+        mjson_get_next(data);
         data->d2++;
       }
     }
-  } else if (tok == MJSON_TOK_KEY && data->d1 == data->d2 + 1 &&
-             data->path[data->pos] == '.' && s[off] == '"' &&
-             s[off + len - 1] == '"' &&
-             mjson_plen(&data->path[data->pos + 1]) == len - 2 &&
-             !memcmp(s + off + 1, &data->path[data->pos + 1], len - 2)) {
+  } else if (tok == MJSON_TOK_KEY && data->d1 == data->d2 + 1 && !end &&
+             seg->key != NULL && s[off] == '"' && s[off + len - 1] == '"' &&
+             seg->len == len - 2 && !memcmp(s + off + 1, seg->key, len - 2)) {
     data->d2++;
-    data->pos += len - 1;
+    mjson_get_next(data);
   } else if (tok == MJSON_TOK_KEY && data->d1 == data->d2) {
     return 1;  // Exhausted path, not found
   } else if (tok == '}' || tok == ']') {
     data->d1--;
     // data->d2--;
-    if (!data->path[data->pos] && data->d1 == data->d2 && data->obj != -1) {
+    if (end && data->d1 == data->d2 && data->obj != -1) {
       data->tok = tok - 2;
       if (data->tokptr) *data->tokptr = s + data->obj;
       if (data->toklen) *data->toklen = off - data->obj + 1;
       return 1;
     }
+    if (data->d1 < data->d2) return 1;  // Left a container on the path
   } else if (MJSON_TOK_IS_VALUE(tok)) {
     // printf("TOK --> %d\n", tok);
-    if (data->d1 == data->d2 && !data->path[data->pos]) {
+    if (data->d1 == data->d2 && end) {
       data->tok = tok;
       if (data->tokptr) *data->tokptr = s + off;
       if (data->toklen) *data->toklen = len;
@@ -240,137 +1356,1051 @@ static int mjson_get_cb(int tok, const char *s, int off, int len, void *ud) {
   return 0;
 }
 
-enum mjson_tok mjson_find(const char *s, int len, const char *jp,
-                          const char **tokptr, int *toklen) {
-  struct msjon_get_data data = {jp, 1,  0,      0,      0,
-                                0,  -1, tokptr, toklen, MJSON_TOK_INVALID};
+// Look up a path with wildcards, slices or filters: take the first match
+static MJSON_NOINLINE enum mjson_tok mjson_find_query(
+    const char *s, ptrdiff_t len, const struct mjson_path *cp,
+    const char **tokptr, ptrdiff_t *toklen) {
+  struct querydata q;
+  q.path = cp, q.cb = NULL, q.ud = NULL, q.first = 1;
+  mjson_query_cp(s, 0, len, &q, 1);
+  if (q.tok != MJSON_TOK_INVALID && tokptr != NULL) *tokptr = s + q.off;
+  if (q.tok != MJSON_TOK_INVALID && toklen != NULL) *toklen = q.len;
+  return (enum mjson_tok) q.tok;
+}
+
+static enum mjson_tok mjson_find_cp(const char *s, ptrdiff_t len,
+                                    const struct mjson_path *cp,
+                                    const char **tokptr, ptrdiff_t *toklen) {
+  struct mjson_get_data data;
+  if (!mjson_path_exact(cp)) {
+    return mjson_find_query(s, len, cp, tokptr, toklen);
+  }
+  mjson_get_init(&data, cp, NULL, tokptr, toklen);
+  if (mjson_walk(s, 0, len, mjson_get_cb, &data) < 0) return MJSON_TOK_INVALID;
+  return (enum mjson_tok) data.tok;
+}
+
+enum mjson_tok mjson_find_compiled(const char *s, int len,
+                                   const struct mjson_path *cp,
+                                   const char **tokptr, int *toklen) {
+  ptrdiff_t n = 0;
+  enum mjson_tok tok = mjson_find_cp(s, len, cp, tokptr, &n);
+  if (toklen != NULL && tok != MJSON_TOK_INVALID) *toklen = (int) n;
+  return tok;
+}
+
+// Compile a path that is not exact, so that the struct mjson_path is only
+// on the stack when it is needed
+static MJSON_NOINLINE enum mjson_tok mjson_find_compile(
+    const char *s, ptrdiff_t len, const char *jp, const char **tokptr,
+    ptrdiff_t *toklen) {
+  struct mjson_path cp;
+  if (mjson_path_compile(jp, &cp) < 0) return MJSON_TOK_INVALID;
+  return mjson_find_cp(s, len, &cp, tokptr, toklen);
+}
+
+enum mjson_tok mjson_find64(const char *s, ptrdiff_t len, const char *jp,
+                            const char **tokptr, ptrdiff_t *toklen) {
+  struct mjson_get_data data;
   if (jp[0] != '$') return MJSON_TOK_INVALID;
-  if (mjson(s, len, mjson_get_cb, &data) < 0) return MJSON_TOK_INVALID;
+  // Exact paths are matched straight from the string, segment by segment
+  if (!mjson_path_is_exact(jp)) {
+    return mjson_find_compile(s, len, jp, tokptr, toklen);
+  }
+  mjson_get_init(&data, NULL, jp + 1, tokptr, toklen);
+  if (mjson_walk(s, 0, len, mjson_get_cb, &data) < 0) return MJSON_TOK_INVALID;
   return (enum mjson_tok) data.tok;
 }
 
-int mjson_get_number(const char *s, int len, const char *path, double *v) {
-  const char *p;
-  int tok, n;
-  if ((tok = mjson_find(s, len, path, &p, &n)) == MJSON_TOK_NUMBER) {
-    if (v != NULL) *v = strtod(p, NULL);
+enum mjson_tok mjson_find(const char *s, int len, const char *jp,
+                          const char **tokptr, int *toklen) {
+  ptrdiff_t n = 0;
+  enum mjson_tok tok = mjson_find64(s, len, jp, tokptr, &n);
+  if (toklen != NULL && tok != MJSON_TOK_INVALID) *toklen = (int) n;
+  return tok;
+}
+
+struct manydata {
+  struct mjson_get_data *data;  // Lookup state, one per path
+  int npaths;                   // Number of paths
+  int left;                     // Number of paths still looked up
+};
+
+static int mjson_many_cb(int tok, const char *s, ptrdiff_t off, ptrdiff_t len,
+                         void *ud) {
+  struct manydata *m = (struct manydata *) ud;
+  int i, r, skip = 1;
+  for (i = 0; i < m->npaths; i++) {
+    struct mjson_get_data *d = &m->data[i];
+    if (d->jp == NULL) continue;  // Already resolved
+    r = mjson_get_cb(tok, s, off, len, d);
+    if (r != MJSON_SKIP) skip = 0;
+    if (r == 1) d->jp = NULL, m->left--;
+  }
+  // Skip a container only if no path can lead into it
+  return m->left == 0 ? 1 : skip ? MJSON_SKIP : 0;
+}
+
+int mjson_find_many(const char *s, int len, const char **paths, int npaths,
+                    struct mjson_hit *out) {
+  struct mjson_get_data data[MJSON_MANY_PATHS];
+  ptrdiff_t lens[MJSON_MANY_PATHS];
+  struct manydata m;
+  int i, j, found = 0;
+  m.data = data;
+  // Up to MJSON_MANY_PATHS paths are looked up per pass over the document
+  for (i = 0; i < npaths; i += m.npaths) {
+    m.npaths = npaths - i < MJSON_MANY_PATHS ? npaths - i : MJSON_MANY_PATHS;
+    m.left = 0;
+    for (j = 0; j < m.npaths; j++) {
+      const char *jp = paths[i + j];
+      out[i + j].ptr = NULL;
+      lens[j] = 0;
+      if (mjson_path_is_exact(jp)) {
+        mjson_get_init(&data[j], NULL, jp + 1, &out[i + j].ptr, &lens[j]);
+        m.left++;
+      } else {
+        // Wildcards and slices need the query engine, look them up alone
+        data[j].tok = mjson_find64(s, len, jp, &out[i + j].ptr, &lens[j]);
+        data[j].jp = NULL;
+      }
+    }
+    if (m.left > 0) mjson_walk(s, 0, len, mjson_many_cb, &m);
+    for (j = 0; j < m.npaths; j++) {
+      out[i + j].tok = data[j].tok;
+      out[i + j].len = (int) lens[j];
+      if (data[j].tok != MJSON_TOK_INVALID) found++;
+    }
+  }
+  return found;
+}
+
+struct foreachdata {
+  mjson_foreach_cb_t cb;  // User callback
+  void *ud;               // Its user data
+  int depth;              // Open containers
+  int obj;                // The container is an object
+  int index;              // Children seen so far
+  ptrdiff_t koff, klen;   // Current key
+  ptrdiff_t voff;         // Current value
+};
+
+static int mjson_foreach_one(struct foreachdata *d, const char *s,
+                             ptrdiff_t vlen, int tok) {
+  int koff = d->obj ? (int) d->koff : 0, klen = d->obj ? (int) d->klen : 0;
+  return d->cb(s, d->index++, koff, klen, (int) d->voff, (int) vlen, tok,
+               d->ud) != 0;
+}
+
+static int mjson_foreach_cb(int tok, const char *s, ptrdiff_t off,
+                            ptrdiff_t len, void *ud) {
+  struct foreachdata *d = (struct foreachdata *) ud;
+  if (tok == '{' || tok == '[') {
+    if (d->depth == 0) d->obj = tok == '{';
+    if (d->depth++ != 1) return 0;
+    d->voff = off;
+    return MJSON_SKIP;  // A child container, jump to its end
+  } else if (tok == '}' || tok == ']') {
+    if (--d->depth == 1) return mjson_foreach_one(d, s, off + 1 - d->voff,
+                                                  tok - 2);
+  } else if (tok == MJSON_TOK_KEY) {
+    d->koff = off, d->klen = len;
+  } else if (MJSON_TOK_IS_VALUE(tok) && d->depth == 1) {
+    d->voff = off;
+    return mjson_foreach_one(d, s, len, tok);
   }
+  return 0;
+}
+
+int mjson_foreach(const char *s, int len, mjson_foreach_cb_t cb, void *ud) {
+  struct foreachdata d;
+  ptrdiff_t res;
+  memset(&d, 0, sizeof(d));
+  d.cb = cb, d.ud = ud;
+  res = mjson_walk(s, 0, len, mjson_foreach_cb, &d);
+  return res < 0 ? (int) res : d.index;
+}
+
+// The mjson_get_*() functions below decode a value found by a lookup
+static int mjson_tok_number(int tok, const char *p, int n, double *v) {
+  if (tok == MJSON_TOK_NUMBER && v != NULL) mjson_pass_number(p, n, v);
   return tok == MJSON_TOK_NUMBER ? 1 : 0;
 }
 
-int mjson_get_bool(const char *s, int len, const char *path, int *v) {
-  int tok = mjson_find(s, len, path, NULL, NULL);
+static int mjson_tok_bool(int tok, int *v) {
   if (tok == MJSON_TOK_TRUE && v != NULL) *v = 1;
   if (tok == MJSON_TOK_FALSE && v != NULL) *v = 0;
   return tok == MJSON_TOK_TRUE || tok == MJSON_TOK_FALSE ? 1 : 0;
 }
 
-static unsigned char mjson_unhex_nimble(const char *s) {
-  unsigned char i, v = 0;
-  for (i = 0; i < 2; i++) {
-    int c = s[i];
-    if (i > 0) v <<= 4;
-    v |= (c >= '0' && c <= '9') ? c - '0'
-                                : (c >= 'A' && c <= 'F') ? c - '7' : c - 'W';
+// Parse integer p, n into its magnitude and sign. Return 1 if it fits into
+// `max`, -1 if it does not, or 0 if it is not an integer number
+static int mjson_tok_int(int tok, const char *p, int n, mjson_uint64_t max,
+                         mjson_uint64_t *mag, int *neg) {
+  mjson_uint64_t v = 0;
+  int i = 0;
+  if (tok != MJSON_TOK_NUMBER) return 0;
+  if ((*neg = p[0] == '-') != 0) i++;
+  for (; i < n && mjson_isdigit(p[i]); i++) {
+    unsigned d = (unsigned) (p[i] - '0');
+    if (v > (max - d) / 10) return -1;
+    v = v * 10 + d;
+  }
+  if (i < n) return 0;  // Fraction or exponent
+  *mag = v;
+  return 1;
+}
+
+static int mjson_tok_i64(int tok, const char *p, int n, mjson_int64_t *v) {
+  mjson_uint64_t m = 0, max = ~(mjson_uint64_t) 0 >> 1;
+  int neg = 0, r = mjson_tok_int(tok, p, n, max + 1, &m, &neg);
+  if (r == 1 && !neg && m > max) r = -1;
+  if (r == 1 && v != NULL) {
+    // -2^63 has no positive counterpart, negate it as unsigned
+    *v = neg ? (mjson_int64_t) (~m + 1) : (mjson_int64_t) m;
+  }
+  return r;
+}
+
+static int mjson_tok_u64(int tok, const char *p, int n, mjson_uint64_t *v) {
+  mjson_uint64_t m = 0;
+  int neg = 0, r = mjson_tok_int(tok, p, n, ~(mjson_uint64_t) 0, &m, &neg);
+  if (r == 1 && neg && m != 0) r = -1;
+  if (r == 1 && v != NULL) *v = m;
+  return r;
+}
+
+int mjson_get_number(const char *s, int len, const char *path, double *v) {
+  const char *p;
+  int n, tok = mjson_find(s, len, path, &p, &n);
+  return mjson_tok_number(tok, p, n, v);
+}
+
+int mjson_get_bool(const char *s, int len, const char *path, int *v) {
+  return mjson_tok_bool(mjson_find(s, len, path, NULL, NULL), v);
+}
+
+int mjson_get_i64(const char *s, int len, const char *path, mjson_int64_t *v) {
+  const char *p;
+  int n = 0, tok = mjson_find(s, len, path, &p, &n);
+  return mjson_tok_i64(tok, p, n, v);
+}
+
+int mjson_get_u64(const char *s, int len, const char *path, mjson_uint64_t *v) {
+  const char *p;
+  int n = 0, tok = mjson_find(s, len, path, &p, &n);
+  return mjson_tok_u64(tok, p, n, v);
+}
+
+// Hex digit values, -1 for anything else
+static const signed char mjson_hextab[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static int mjson_hexval(int c) {
+  return mjson_hextab[(unsigned char) c];
+}
+
+// Parse the XXXX of a \uXXXX escape. Return the code unit, or -1
+static long mjson_unhex4(const char *s) {
+  long v = 0;
+  int i, d;
+  for (i = 0; i < 4; i++) {
+    if ((d = mjson_hexval(s[i])) < 0) return -1;
+    v = (v << 4) | d;
   }
   return v;
 }
 
-static int mjson_unescape(const char *s, int len, char *to, int n) {
-  int i, j;
-  for (i = 0, j = 0; i < len && j < n; i++, j++) {
-    if (s[i] == '\\' && i + 5 < len && s[i + 1] == 'u') {
-      //  \uXXXX escape. We could process a simple one-byte chars
-      // \u00xx from the ASCII range. More complex chars would require
-      // dragging in a UTF8 library, which is too much for us
-      if (s[i + 2] != '0' || s[i + 3] != '0') return -1;  // Too much, give up
-      to[j] = mjson_unhex_nimble(s + i + 4);
-      i += 5;
-    } else if (s[i] == '\\' && i + 1 < len) {
-      int c = mjson_esc(s[i + 1], 0);
-      if (c == 0) return -1;
-      to[j] = c;
-      i++;
+// Decode the \uXXXX escape at s[i], or a surrogate pair of them, to UTF-8
+// into to, n. Return the number of bytes written, or -1 if the escape is
+// malformed or does not fit. Store the escape length into *elen
+static int mjson_unescape_u(const char *s, int i, int len, char *to, int n,
+                            int *elen) {
+  long lo, cp = i + 6 <= len ? mjson_unhex4(s + i + 2) : -1;
+  unsigned char *d = (unsigned char *) to;
+  *elen = 6;
+  if (cp >= 0xdc00 && cp < 0xe000) return -1;  // Lone low surrogate
+  if (cp >= 0xd800 && cp < 0xdc00) {
+    // High surrogate, must be followed by a low one
+    if (i + 12 > len || s[i + 6] != '\\' || s[i + 7] != 'u') return -1;
+    lo = mjson_unhex4(s + i + 8);
+    if (lo < 0xdc00 || lo >= 0xe000) return -1;
+    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+    *elen = 12;
+  }
+  if (cp < 0) return -1;
+  if (cp < 0x80) {
+    if (n < 1) return -1;
+    d[0] = (unsigned char) cp;
+    return 1;
+  } else if (cp < 0x800) {
+    if (n < 2) return -1;
+    d[0] = (unsigned char) (0xc0 | (cp >> 6));
+    d[1] = (unsigned char) (0x80 | (cp & 0x3f));
+    return 2;
+  } else if (cp < 0x10000) {
+    if (n < 3) return -1;
+    d[0] = (unsigned char) (0xe0 | (cp >> 12));
+    d[1] = (unsigned char) (0x80 | ((cp >> 6) & 0x3f));
+    d[2] = (unsigned char) (0x80 | (cp & 0x3f));
+    return 3;
+  }
+  if (n < 4) return -1;
+  d[0] = (unsigned char) (0xf0 | (cp >> 18));
+  d[1] = (unsigned char) (0x80 | ((cp >> 12) & 0x3f));
+  d[2] = (unsigned char) (0x80 | ((cp >> 6) & 0x3f));
+  d[3] = (unsigned char) (0x80 | (cp & 0x3f));
+  return 4;
+}
+
+// Unescape s, len into at most n bytes of `to`, which can be s itself: no
+// escape is shorter than what it decodes to. Return the unescaped length,
+// or -1 if an escape is bad or it does not fit
+static int mjson_unescape_n(const char *s, int len, char *to, int n) {
+  int i = 0, j = 0, k, run;
+  while (i < len) {
+    // Copy the run up to the next escape in one go
+    const char *e = (const char *) memchr(s + i, '\\', (size_t) (len - i));
+    k = e == NULL ? len : (int) (e - s);
+    run = k - i;
+    if (run > n - j) {
+      memmove(to + j, s + i, (size_t) (n - j));
+      return -1;
+    }
+    memmove(to + j, s + i, (size_t) run);
+    i = k, j += run;
+    if (i >= len) break;
+    if (i + 1 < len && s[i + 1] == 'u') {
+      int w = mjson_unescape_u(s, i, len, to + j, n - j, &k);
+      if (w < 0) return -1;
+      i += k, j += w;
     } else {
-      to[j] = s[i];
+      int c = i + 1 >= len ? 0 : s[i + 1] == '/' ? '/' : mjson_esc(s[i + 1], 0);
+      if (c == 0 || j >= n) return -1;
+      to[j++] = (char) c;
+      i += 2;
     }
   }
-  if (j >= n) return -1;
-  if (n > 0) to[j] = '\0';
   return j;
 }
 
+static int mjson_unescape(const char *s, int len, char *to, int n) {
+  int j = mjson_unescape_n(s, len, to, n);
+  if (j < 0 || j >= n) return -1;
+  to[j] = '\0';
+  return j;
+}
+
+int mjson_unescape_inplace(char *s, int len) {
+  return mjson_unescape_n(s, len, s, len);
+}
+
+static int mjson_tok_string(int tok, const char *p, int sz, char *to, int n) {
+  if (tok != MJSON_TOK_STRING) return -1;
+  return mjson_unescape(p + 1, sz - 2, to, n);
+}
+
+#if MJSON_ENABLE_SIMD
+// Nibble values of 16 hex digits. Set *bad to the mask of invalid ones
+static __m128i mjson_unhex_nibbles(__m128i v, unsigned *bad) {
+  const __m128i neg = _mm_set1_epi8(-1);
+  __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+  __m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'));
+  __m128i isd = _mm_and_si128(_mm_cmpgt_epi8(d, neg),
+                              _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+  __m128i isl = _mm_and_si128(_mm_cmpgt_epi8(l, neg),
+                              _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+  *bad = (unsigned) _mm_movemask_epi8(_mm_or_si128(isd, isl)) ^ 0xffff;
+  return _mm_or_si128(
+      _mm_and_si128(isd, d),
+      _mm_and_si128(isl, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+// Join nibble pairs: every 16-bit lane holds the high nibble in its low byte
+static __m128i mjson_unhex_join(__m128i v) {
+  __m128i hi = _mm_and_si128(v, _mm_set1_epi16(0xff));
+  return _mm_or_si128(_mm_slli_epi16(hi, 4), _mm_srli_epi16(v, 8));
+}
+
+// Decode 32 hex digits into 16 bytes at a time. Return the offset of the
+// first block with an invalid digit, or the end of the last whole block
+static ptrdiff_t mjson_unhex_sse2(const char *s, ptrdiff_t i, ptrdiff_t n,
+                                  unsigned char *to) {
+  for (; i + 32 <= n; i += 32) {
+    unsigned b1, b2;
+    __m128i v1 = mjson_unhex_nibbles(
+        _mm_loadu_si128((const __m128i *) (s + i)), &b1);
+    __m128i v2 = mjson_unhex_nibbles(
+        _mm_loadu_si128((const __m128i *) (s + i + 16)), &b2);
+    if (b1 | b2) break;
+    _mm_storeu_si128((__m128i *) (to + i / 2),
+                     _mm_packus_epi16(mjson_unhex_join(v1),
+                                      mjson_unhex_join(v2)));
+  }
+  return i;
+}
+
+#if MJSON_AVX2
+// Same as above, 64 digits at a time
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static ptrdiff_t mjson_unhex_avx2(const char *s, ptrdiff_t i, ptrdiff_t n,
+                                  unsigned char *to) {
+  const __m256i neg = _mm256_set1_epi8(-1), lc = _mm256_set1_epi8(0x20);
+  const __m256i c0 = _mm256_set1_epi8('0'), ca = _mm256_set1_epi8('a');
+  const __m256i ten = _mm256_set1_epi8(10), six = _mm256_set1_epi8(6);
+  const __m256i ff = _mm256_set1_epi16(0xff);
+  __m256i x[2];
+  int k;
+  for (; i + 64 <= n; i += 64) {
+    unsigned bad = 0;
+    for (k = 0; k < 2; k++) {
+      __m256i v = _mm256_loadu_si256((const __m256i *) (s + i + k * 32));
+      __m256i d = _mm256_sub_epi8(v, c0);
+      __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, lc), ca);
+      __m256i isd = _mm256_and_si256(_mm256_cmpgt_epi8(d, neg),
+                                     _mm256_cmpgt_epi8(ten, d));
+      __m256i isl = _mm256_and_si256(_mm256_cmpgt_epi8(l, neg),
+                                     _mm256_cmpgt_epi8(six, l));
+      bad |= ~(unsigned) _mm256_movemask_epi8(_mm256_or_si256(isd, isl));
+      v = _mm256_or_si256(_mm256_and_si256(isd, d),
+                          _mm256_and_si256(isl, _mm256_add_epi8(l, ten)));
+      x[k] = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, ff), 4),
+                             _mm256_srli_epi16(v, 8));
+    }
+    if (bad) break;
+    // Packing works within 128-bit lanes, put the quarters back in order
+    _mm256_storeu_si256(
+        (__m256i *) (to + i / 2),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(x[0], x[1]), 0xd8));
+  }
+  return i;
+}
+#endif  // MJSON_AVX2
+#endif  // MJSON_ENABLE_SIMD
+
+int mjson_hex_dec(const char *src, int n, char *dst, int dlen, int *erroff) {
+  unsigned char *to = (unsigned char *) dst;
+  ptrdiff_t i = 0, end = (ptrdiff_t) (n / 2 < dlen ? n / 2 : dlen) * 2;
+  int hi, lo;
+  if (n % 2 != 0) {
+    if (erroff != NULL) *erroff = n - 1;  // A digit short
+    return -1;
+  }
+#if MJSON_ENABLE_SIMD
+#if MJSON_AVX2
+  if (end >= 64 && mjson_has_avx2()) i = mjson_unhex_avx2(src, i, end, to);
+#endif
+  i = mjson_unhex_sse2(src, i, end, to);
+#endif
+  // The rest, or the block where the vector loop found a bad digit
+  for (; i < end; i += 2) {
+    hi = mjson_hextab[(unsigned char) src[i]];
+    lo = mjson_hextab[(unsigned char) src[i + 1]];
+    if ((hi | lo) < 0) {
+      if (erroff != NULL) *erroff = (int) (hi < 0 ? i : i + 1);
+      return -1;
+    }
+    to[i / 2] = (unsigned char) ((hi << 4) | lo);
+  }
+  // Digits that don't fit into dst are not decoded, but must still be valid
+  for (; i < n; i++) {
+    if (mjson_hextab[(unsigned char) src[i]] < 0) {
+      if (erroff != NULL) *erroff = (int) i;
+      return -1;
+    }
+  }
+  if (end / 2 < dlen) dst[end / 2] = '\0';
+  return (int) (end / 2);
+}
+
+static int mjson_tok_hex(int tok, const char *p, int sz, char *to, int n) {
+  if (tok != MJSON_TOK_STRING) return -1;
+  return mjson_hex_dec(p + 1, sz - 2, to, n, NULL);
+}
+
 int mjson_get_string(const char *s, int len, const char *path, char *to,
                      int n) {
   const char *p;
-  int sz;
-  if (mjson_find(s, len, path, &p, &sz) != MJSON_TOK_STRING) return -1;
-  return mjson_unescape(p + 1, sz - 2, to, n);
+  int sz, tok = mjson_find(s, len, path, &p, &sz);
+  return mjson_tok_string(tok, p, sz, to, n);
+}
+
+int mjson_get_string_view(const char *s, int len, const char *path,
+                          const char **ptr, int *escaped) {
+  const char *p;
+  int sz, tok = mjson_find(s, len, path, &p, &sz);
+  if (tok != MJSON_TOK_STRING) return -1;
+  if (ptr != NULL) *ptr = p + 1;
+  if (escaped != NULL) *escaped = memchr(p + 1, '\\', (size_t) sz - 2) != NULL;
+  return sz - 2;
 }
 
 int mjson_get_hex(const char *s, int len, const char *x, char *to, int n) {
   const char *p;
-  int i, j, sz;
-  if (mjson_find(s, len, x, &p, &sz) != MJSON_TOK_STRING) return -1;
-  for (i = j = 0; i < sz - 3 && j < n; i += 2, j++) {
-    ((unsigned char *) to)[j] = mjson_unhex_nimble(p + i + 1);
-  }
-  if (j < n) to[j] = '\0';
-  return j;
+  int sz, tok = mjson_find(s, len, x, &p, &sz);
+  return mjson_tok_hex(tok, p, sz, to, n);
 }
 
 #if MJSON_ENABLE_BASE64
-static int mjson_base64rev(int c) {
-  if (c >= 'A' && c <= 'Z') {
-    return c - 'A';
-  } else if (c >= 'a' && c <= 'z') {
-    return c + 26 - 'a';
-  } else if (c >= '0' && c <= '9') {
-    return c + 52 - '0';
-  } else if (c == '+') {
-    return 62;
-  } else if (c == '/') {
-    return 63;
-  } else {
-    return 64;
+// Base64 digit values, -1 for anything else. Both the standard alphabet and
+// the URL-safe one, with '-' and '_' for '+' and '/', are accepted
+static const signed char mjson_b64tab[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, 62, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+#if MJSON_AVX2
+// Decode 32 digits into 24 bytes at a time, while there is room for a
+// 32-byte store. Return the number of digits decoded: the loop stops at the
+// first block with an invalid digit, leaving it to the scalar loop
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static int mjson_b64_avx2(const char *s, int n, unsigned char *to, int size) {
+#define MJSON_IN(v, a, b)                                    \
+  _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(a - 1)), \
+                   _mm256_cmpgt_epi8(_mm256_set1_epi8(b + 1), v))
+  const __m256i shuf = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+      4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  int i, j;
+  for (i = j = 0; i + 32 <= n && j + 32 <= size; i += 32, j += 24) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    __m256i up = MJSON_IN(v, 'A', 'Z'), lo = MJSON_IN(v, 'a', 'z');
+    __m256i dig = MJSON_IN(v, '0', '9');
+    __m256i c62 = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')),
+                                  _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+    __m256i c63 = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')),
+                                  _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    __m256i ok = _mm256_or_si256(
+        _mm256_or_si256(up, lo),
+        _mm256_or_si256(dig, _mm256_or_si256(c62, c63)));
+    if (_mm256_movemask_epi8(ok) != -1) break;
+    // Digit values: the sum of each class mask ANDed with its offset
+    v = _mm256_add_epi8(
+        v, _mm256_or_si256(
+               _mm256_or_si256(
+                   _mm256_and_si256(up, _mm256_set1_epi8(-'A')),
+                   _mm256_and_si256(lo, _mm256_set1_epi8(26 - 'a'))),
+               _mm256_and_si256(dig, _mm256_set1_epi8(52 - '0'))));
+    v = _mm256_or_si256(
+        _mm256_andnot_si256(_mm256_or_si256(c62, c63), v),
+        _mm256_or_si256(_mm256_and_si256(c62, _mm256_set1_epi8(62)),
+                        _mm256_and_si256(c63, _mm256_set1_epi8(63))));
+    // Join 4 x 6 bits into 24 bits per 32-bit lane, then pack the bytes
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, shuf), perm);
+    _mm256_storeu_si256((__m256i *) (to + j), v);
   }
+#undef MJSON_IN
+  return i;
 }
-
-int mjson_base64_dec(const char *src, int n, char *dst, int dlen) {
-  const char *end = src + n;
-  int len = 0;
-  while (src + 3 < end && len < dlen) {
-    int a = mjson_base64rev(src[0]), b = mjson_base64rev(src[1]),
-        c = mjson_base64rev(src[2]), d = mjson_base64rev(src[3]);
-    dst[len++] = (a << 2) | (b >> 4);
-    if (src[2] != '=' && len < dlen) {
-      dst[len++] = (b << 4) | (c >> 2);
-      if (src[3] != '=' && len < dlen) {
-        dst[len++] = (c << 6) | d;
-      }
+#endif  // MJSON_AVX2
+
+// Decode base64 src, n into dst, dlen. Padding, or a short last group of
+// 2 or 3 digits, is only allowed if `last` is set. Return the decoded
+// length, of which only the first dlen bytes are stored, or -1 if src is
+// malformed
+static int mjson_b64_decode(const char *src, int n, unsigned char *dst,
+                            int dlen, int last) {
+  unsigned char b[3];
+  unsigned long v;
+  int i = 0, j = 0, k, pad = 0, body, tail;
+  if (last && n >= 4 && n % 4 == 0 && src[n - 1] == '=') {
+    pad = src[n - 2] == '=' ? 2 : 1;
+  }
+  body = n - pad, tail = body % 4;
+  if (tail == 1 || (tail > 0 && !last)) return -1;
+  body -= tail;
+#if MJSON_AVX2
+  if (body >= 32 && dlen >= 32 && mjson_has_avx2()) {
+    i = mjson_b64_avx2(src, body, dst, dlen);
+    j = i / 4 * 3;
+  }
+#endif
+  for (; i < n - pad; i += 4) {
+    int a = mjson_b64tab[(unsigned char) src[i]];
+    int c = i + 2 < n - pad ? mjson_b64tab[(unsigned char) src[i + 2]] : 0;
+    int d = i + 3 < n - pad ? mjson_b64tab[(unsigned char) src[i + 3]] : 0;
+    int bb = mjson_b64tab[(unsigned char) src[i + 1]];
+    if ((a | bb | c | d) < 0) return -1;
+    v = ((unsigned long) a << 18) | ((unsigned long) bb << 12) |
+        ((unsigned long) c << 6) | (unsigned long) d;
+    b[0] = (unsigned char) (v >> 16);
+    b[1] = (unsigned char) (v >> 8);
+    b[2] = (unsigned char) v;
+    k = i < body ? 3 : tail - 1;
+    if (k < 3 && b[k] != 0) return -1;  // Unused low bits must be zero
+    for (k--; k >= 0; k--) {
+      if (j + k < dlen) dst[j + k] = b[k];
     }
-    src += 4;
+    j += i < body ? 3 : tail - 1;
   }
-  if (len < dlen) dst[len] = '\0';
+  return j;
+}
+
+int mjson_base64_dec(const char *src, int n, char *dst, int dlen) {
+  int len = mjson_b64_decode(src, n, (unsigned char *) dst, dlen, 1);
+  if (len > dlen) len = dlen;
+  if (len >= 0 && len < dlen) dst[len] = '\0';
   return len;
 }
 
+#if MJSON_ENABLE_PRINT
+int mjson_base64_dec_fn(const char *src, int n, mjson_print_fn_t fn,
+                        void *fnd) {
+  unsigned char buf[MJSON_BASE64_CHUNK / 4 * 3];
+  int i, len, total = 0, chunk = MJSON_BASE64_CHUNK / 4 * 4;
+  for (i = 0; i == 0 || i < n; i += chunk) {
+    int last = n - i <= chunk;
+    len = mjson_b64_decode(src + i, last ? n - i : chunk, buf,
+                           (int) sizeof(buf), last);
+    if (len < 0) return -1;
+    if (len > 0) fn((const char *) buf, len, fnd);
+    total += len;
+  }
+  return total;
+}
+#endif
+
+static int mjson_tok_base64(int tok, const char *p, int sz, char *to, int n) {
+  if (tok != MJSON_TOK_STRING) return 0;
+  return mjson_base64_dec(p + 1, sz - 2, to, n);
+}
+
 int mjson_get_base64(const char *s, int len, const char *path, char *to,
                      int n) {
   const char *p;
-  int sz;
-  if (mjson_find(s, len, path, &p, &sz) != MJSON_TOK_STRING) return 0;
-  return mjson_base64_dec(p + 1, sz - 2, to, n);
+  int sz, tok = mjson_find(s, len, path, &p, &sz);
+  return mjson_tok_base64(tok, p, sz, to, n);
 }
 #endif  // MJSON_ENABLE_BASE64
 
+// Field being bound
+struct mjson_bind_state {
+  const struct mjson_path_seg *segs;  // Path segments
+  int n;                              // Number of segments
+  int slot;                           // Array element, for a wildcard path
+};
+
+struct binddata {
+  const struct mjson_bind_field *desc;  // Fields
+  struct mjson_bind_state *fields;      // Their state
+  void *obj;                            // Destination struct
+  unsigned long all;                    // All fields
+  unsigned long once;                   // Fields bound once, without wildcards
+  long found;                           // Fields bound so far
+  int depth;                            // Open containers
+  struct {
+    unsigned long mask;  // Fields whose path leads here
+    ptrdiff_t koff;      // Current key, without quotes
+    ptrdiff_t klen;      // Current key length
+    int index;           // Number of children seen
+    char obj;            // Is an object
+  } levels[MJSON_MAX_DEPTH + 1];
+};
+
+// Store value p, len of type tok into field f, element slot. Return 1 if
+// the value fits the field, 0 otherwise
+static int mjson_bind_value(const struct mjson_bind_field *f, int slot,
+                            void *obj, int tok, const char *p, ptrdiff_t len) {
+  char *dst = (char *) obj + f->offset;
+  double v = 0;
+  int i;
+  switch (f->type) {
+    case MJSON_BIND_NUMBER:
+      if (tok != MJSON_TOK_NUMBER) return 0;
+      if ((size_t) (slot + 1) * sizeof(double) > f->size) return 0;
+      mjson_pass_number(p, len, &v);
+      ((double *) dst)[slot] = v;
+      return 1;
+    case MJSON_BIND_INT:
+    case MJSON_BIND_BOOL:
+      if ((size_t) (slot + 1) * sizeof(int) > f->size) return 0;
+      if (f->type == MJSON_BIND_INT) {
+        if (tok != MJSON_TOK_NUMBER) return 0;
+        mjson_pass_number(p, len, &v);
+        // Out of range, or NaN: the cast would be undefined
+        if (!(v > (double) INT_MIN - 1 && v < (double) INT_MAX + 1)) return 0;
+        i = (int) v;
+      } else if (!mjson_tok_bool(tok, &i)) {
+        return 0;
+      }
+      ((int *) dst)[slot] = i;
+      return 1;
+    case MJSON_BIND_STRING:
+      if (tok != MJSON_TOK_STRING || len - 2 > INT_MAX || f->size == 0) {
+        return 0;
+      }
+      if (mjson_unescape(p + 1, (int) (len - 2), dst, (int) f->size) < 0) {
+        dst[0] = '\0';  // Does not fit
+        return 0;
+      }
+      return 1;
+  }
+  return 0;
+}
+
+static int mjson_bind_cb(int tok, const char *s, ptrdiff_t off, ptrdiff_t len,
+                         void *ud) {
+  struct binddata *b = (struct binddata *) ud;
+  int i, d = b->depth, index;
+  if (tok == MJSON_TOK_KEY) {
+    b->levels[d].koff = off + 1, b->levels[d].klen = len - 2;
+  } else if (tok == '}' || tok == ']') {
+    b->depth--;
+  } else if (tok == '{' || tok == '[' || MJSON_TOK_IS_VALUE(tok)) {
+    // The root value is "$" itself. Any other value at depth d matches
+    // segment d - 1 of the fields whose path leads to its parent
+    unsigned long bit, v = d == 0 ? b->all : 0, mask = b->levels[d].mask;
+    const char *key = b->levels[d].obj ? s + b->levels[d].koff : NULL;
+    ptrdiff_t klen = b->levels[d].klen;
+    index = b->levels[d].index++;
+    for (i = 0; d > 0 && (mask >> i) != 0; i++) {
+      const struct mjson_path_seg *seg;
+      if (!((mask >> i) & 1)) continue;
+      seg = &b->fields[i].segs[d - 1];
+      if ((seg->flags & MJSON_PATH_ANY) ||
+          (key == NULL ? seg->key == NULL && index >= seg->len &&
+                             index < seg->end
+                       : seg->key != NULL && seg->len == klen &&
+                             memcmp(seg->key, key, (size_t) klen) == 0)) {
+        v |= 1UL << i;
+        if (seg->key == NULL && seg->end != seg->len + 1) {
+          b->fields[i].slot = index - seg->len;  // Wildcard or slice
+        }
+      }
+    }
+    for (i = 0, mask = 0; (v >> i) != 0; i++) {
+      bit = 1UL << i;
+      if (!(v & bit)) continue;
+      if (b->fields[i].n > d) {
+        mask |= bit;  // The path goes on inside
+      } else if (mjson_bind_value(&b->desc[i], b->fields[i].slot, b->obj, tok,
+                                  s + off, len)) {
+        b->found |= (long) bit;
+      }
+    }
+    // Stop once every field without a wildcard is bound
+    if (b->once == b->all && ((unsigned long) b->found & b->all) == b->all) {
+      return 1;
+    }
+    if (tok == '{' || tok == '[') {
+      d = ++b->depth;
+      b->levels[d].mask = mask, b->levels[d].index = 0;
+      b->levels[d].obj = tok == '{';
+      return mask == 0 ? MJSON_SKIP : 0;
+    }
+  }
+  return 0;
+}
+
+long mjson_bind(const char *s, int len, const struct mjson_bind_field *desc,
+                int n, void *obj) {
+  struct mjson_path cp;
+  struct binddata b;
+  ptrdiff_t res;
+  int i, j, k, total = 0, size;
+  if (n < 0 || n >= (int) sizeof(long) * 8) return MJSON_ERROR_TOO_LONG;
+  // Check the paths and count their segments first, then keep the segments
+  // of all paths in one array
+  for (i = 0; i < n; i++) {
+    if (mjson_path_compile(desc[i].path, &cp) < 0) {
+      return MJSON_ERROR_INVALID_INPUT;
+    }
+    for (j = k = 0; j < cp.n; j++) {
+      const struct mjson_path_seg *seg = &cp.segs[j];
+      if (seg->flags & (MJSON_PATH_DEEP | MJSON_PATH_FILTER)) k += 2;
+      if (seg->key == NULL && seg->end != seg->len + 1) k++;
+    }
+    // No recursion or filters, one wildcard or slice per path, and no
+    // arrays of strings
+    if (k > 1 || (k > 0 && desc[i].type == MJSON_BIND_STRING)) {
+      return MJSON_ERROR_INVALID_INPUT;
+    }
+    total += cp.n;
+  }
+  size = total > 0 ? total : 1;
+  {
+#if !defined(_MSC_VER)
+    struct mjson_path_seg segs[size];
+    struct mjson_bind_state fields[n > 0 ? n : 1];
+#else
+    struct mjson_path_seg *segs =
+        (struct mjson_path_seg *) alloca(size * sizeof(*segs));
+    struct mjson_bind_state *fields = (struct mjson_bind_state *) alloca(
+        (n > 0 ? n : 1) * sizeof(*fields));
+#endif
+    b.desc = desc, b.fields = fields, b.obj = obj;
+    b.all = b.once = 0, b.found = 0, b.depth = 0;
+    b.levels[0].obj = 0, b.levels[0].index = 0;
+    for (i = total = 0; i < n; i++) {
+      mjson_path_compile(desc[i].path, &cp);
+      memcpy(&segs[total], cp.segs, (size_t) cp.n * sizeof(cp.segs[0]));
+      fields[i].segs = &segs[total], fields[i].n = cp.n, fields[i].slot = 0;
+      total += cp.n;
+      b.all |= 1UL << i;
+      if (mjson_path_exact(&cp)) b.once |= 1UL << i;
+    }
+    res = n > 0 ? mjson_walk(s, 0, len, mjson_bind_cb, &b) : 0;
+  }
+  return res < 0 ? (long) res : b.found;
+}
+
+#if MJSON_ENABLE_INDEX
+struct indexdata {
+  struct mjson_tape *tape;
+  int depth;                  // Number of open containers
+  int open[MJSON_MAX_DEPTH];  // Their entry indices
+  int count[MJSON_MAX_DEPTH]; // Their number of children
+  int last[MJSON_MAX_DEPTH];  // For arrays, the last skip point
+  int full;                   // Set when the tape runs out of entries
+};
+
+static int index_cb(int tok, const char *s, int off, int len, void *ud) {
+  struct indexdata *d = (struct indexdata *) ud;
+  struct mjson_tape *t = d->tape;
+  struct mjson_tape_entry *e;
+  if (tok == ',' || tok == ':') return 0;
+  if (tok == '}' || tok == ']') {
+    e = &t->entries[d->open[--d->depth]];
+    e->len = off + len - e->off;
+    e->next = t->n;
+    return 0;
+  }
+  if (t->n >= t->size) return d->full = 1;
+  e = &t->entries[t->n];
+  e->off = off;
+  e->len = len;
+  e->next = t->n + 1;
+  e->skip = -1;
+  e->type = (short) (tok == '{' ? MJSON_TOK_OBJECT
+                                : tok == '[' ? MJSON_TOK_ARRAY : tok);
+  e->depth = (short) d->depth;
+  if (d->depth > 0 &&
+      t->entries[d->open[d->depth - 1]].type == MJSON_TOK_ARRAY &&
+      d->count[d->depth - 1]++ % MJSON_INDEX_STRIDE == 0) {
+    // Every K-th array element points to the next one, so that looking
+    // up element i takes i / K + i % K hops instead of i
+    int *last = &d->last[d->depth - 1];
+    if (*last >= 0) t->entries[*last].skip = t->n;
+    *last = t->n;
+  }
+  if (tok == '{' || tok == '[') {
+    d->count[d->depth] = 0, d->last[d->depth] = -1;
+    d->open[d->depth++] = t->n;
+  }
+  t->n++;
+  (void) s;
+  return 0;
+}
+
+int mjson_index(const char *s, int len, struct mjson_tape *tape) {
+  struct indexdata d;
+  int res;
+  d.tape = tape, d.depth = 0, d.full = 0;
+  tape->s = s;
+  tape->n = 0;
+  res = mjson(s, len, index_cb, &d);
+  if (d.full) res = MJSON_ERROR_TOO_LONG;
+  if (res < 0) tape->n = 0;
+  return res < 0 ? res : tape->n;
+}
+
+enum mjson_tok mjson_find_ix(const struct mjson_tape *t, const char *path,
+                             const char **tokptr, int *toklen) {
+  const struct mjson_tape_entry *e = t->entries;
+  int i = 0, pos = 1;
+  if (path[0] != '$' || t->n <= 0) return MJSON_TOK_INVALID;
+  while (path[pos] != '\0') {
+    int c = i + 1, end = e[i].next;
+    if (path[pos] == '.' && e[i].type == MJSON_TOK_OBJECT) {
+      const char *key = &path[pos + 1];
+      int n = mjson_plen(key);
+      // Keys and values alternate, so hop from one key to the next
+      while (c < end && (e[c].len != n + 2 ||
+                         memcmp(t->s + e[c].off + 1, key, n) != 0)) {
+        c = e[c + 1].next;
+      }
+      if (c >= end) return MJSON_TOK_INVALID;
+      i = c + 1;
+      pos += n + 1;
+    } else if (path[pos] == '[' && e[i].type == MJSON_TOK_ARRAY) {
+      int k, d = mjson_path_index(&path[pos + 1], &k);
+      // No digits, or too many for an int, can't name an element
+      if (d <= 0 || path[pos + d + 1] != ']') return MJSON_TOK_INVALID;
+      pos += d + 2;
+      for (; c < end && k >= MJSON_INDEX_STRIDE && e[c].skip > 0;
+           k -= MJSON_INDEX_STRIDE) {
+        c = e[c].skip;
+      }
+      while (c < end && k-- > 0) c = e[c].next;
+      if (c >= end) return MJSON_TOK_INVALID;
+      i = c;
+    } else {
+      return MJSON_TOK_INVALID;
+    }
+  }
+  if (tokptr != NULL) *tokptr = t->s + e[i].off;
+  if (toklen != NULL) *toklen = e[i].len;
+  return (enum mjson_tok) e[i].type;
+}
+
+int mjson_get_number_ix(const struct mjson_tape *t, const char *path,
+                        double *v) {
+  const char *p;
+  int n, tok = mjson_find_ix(t, path, &p, &n);
+  return mjson_tok_number(tok, p, n, v);
+}
+
+int mjson_get_bool_ix(const struct mjson_tape *t, const char *path, int *v) {
+  return mjson_tok_bool(mjson_find_ix(t, path, NULL, NULL), v);
+}
+
+int mjson_get_i64_ix(const struct mjson_tape *t, const char *path,
+                     mjson_int64_t *v) {
+  const char *p;
+  int n = 0, tok = mjson_find_ix(t, path, &p, &n);
+  return mjson_tok_i64(tok, p, n, v);
+}
+
+int mjson_get_u64_ix(const struct mjson_tape *t, const char *path,
+                     mjson_uint64_t *v) {
+  const char *p;
+  int n = 0, tok = mjson_find_ix(t, path, &p, &n);
+  return mjson_tok_u64(tok, p, n, v);
+}
+
+int mjson_get_string_ix(const struct mjson_tape *t, const char *path,
+                        char *to, int n) {
+  const char *p;
+  int sz, tok = mjson_find_ix(t, path, &p, &sz);
+  return mjson_tok_string(tok, p, sz, to, n);
+}
+
+int mjson_get_hex_ix(const struct mjson_tape *t, const char *path, char *to,
+                     int n) {
+  const char *p;
+  int sz, tok = mjson_find_ix(t, path, &p, &sz);
+  return mjson_tok_hex(tok, p, sz, to, n);
+}
+
+#if MJSON_ENABLE_BASE64
+int mjson_get_base64_ix(const struct mjson_tape *t, const char *path,
+                        char *to, int n) {
+  const char *p;
+  int sz, tok = mjson_find_ix(t, path, &p, &sz);
+  return mjson_tok_base64(tok, p, sz, to, n);
+}
+#endif
+#endif  // MJSON_ENABLE_INDEX
+
+#if MJSON_ENABLE_CACHE
+// The cache is split into buckets of MJSON_CACHE_WAYS entries. A path of a
+// document can only live in the bucket its hash points to, and evicts the
+// least recently used entry there
+enum mjson_tok mjson_find_cached(struct mjson_cache *c, unsigned long doc,
+                                 unsigned long ver, const char *s, int len,
+                                 const char *path, const char **tokptr,
+                                 int *toklen) {
+  struct mjson_cache_entry *e, *victim;
+  unsigned long h = 2166136261UL ^ doc;
+  size_t n = strlen(path);
+  int i, set, sets, ways = c->size < MJSON_CACHE_WAYS ? c->size
+                                                     : MJSON_CACHE_WAYS;
+  const char *p = NULL;
+  if (ways <= 0 || n >= MJSON_CACHE_PATH_LEN) {
+    return mjson_find(s, len, path, tokptr, toklen);
+  }
+  for (i = 0; path[i] != '\0'; i++) {
+    h = ((h ^ (unsigned char) path[i]) * 16777619UL) & 0xffffffffUL;  // FNV-1a
+  }
+  sets = c->size / ways;
+  set = (int) (h % (unsigned long) sets);
+  e = victim = &c->entries[set * ways];
+  // The last bucket also takes the size % ways entries left over
+  if (set == sets - 1) ways = c->size - set * ways;
+  c->clock++;
+  for (i = 0; i < ways; i++, e++) {
+    if (e->doc == doc && memcmp(e->path, path, n + 1) == 0) {
+      if (e->ver == ver) break;
+      victim = e;  // Stale, computed for another version
+      i = ways;
+      break;
+    }
+    if (e->used < victim->used) victim = e;
+  }
+  if (i < ways) {
+    c->hits++;
+  } else {
+    e = victim;
+    e->tok = mjson_find(s, len, path, &p, &e->len);
+    e->off = p == NULL ? 0 : (int) (p - s);
+    e->doc = doc, e->ver = ver;
+    memcpy(e->path, path, n + 1);
+  }
+  e->used = c->clock;
+  if (e->tok != MJSON_TOK_INVALID && tokptr != NULL) *tokptr = s + e->off;
+  if (e->tok != MJSON_TOK_INVALID && toklen != NULL) *toklen = e->len;
+  return (enum mjson_tok) e->tok;
+}
+
+void mjson_cache_invalidate(struct mjson_cache *c, unsigned long doc) {
+  int i;
+  for (i = 0; i < c->size; i++) {
+    if (c->entries[i].doc == doc) {
+      c->entries[i].path[0] = '\0';
+      c->entries[i].used = 0;
+    }
+  }
+}
+#endif  // MJSON_ENABLE_CACHE
+
 #if MJSON_ENABLE_NEXT
 struct nextdata {
-  int off, len, depth, t, vo, arrayindex;
-  int *koff, *klen, *voff, *vlen, *vtype;
+  ptrdiff_t off, len, vo, arrayindex;
+  int depth, t;
+  ptrdiff_t *koff, *klen, *voff, *vlen;
+  int *vtype;
 };
 
-static int next_cb(int tok, const char *s, int off, int len, void *ud) {
+static int next_cb(int tok, const char *s, ptrdiff_t off, ptrdiff_t len,
+                   void *ud) {
   struct nextdata *d = (struct nextdata *) ud;
   // int i;
   switch (tok) {
@@ -429,11 +2459,61 @@ static int next_cb(int tok, const char *s, int off, int len, void *ud) {
   return 0;
 }
 
+ptrdiff_t mjson_next64(const char *s, ptrdiff_t n, ptrdiff_t off,
+                       ptrdiff_t *koff, ptrdiff_t *klen, ptrdiff_t *voff,
+                       ptrdiff_t *vlen, int *vtype) {
+  struct nextdata d = {off, 0, 0, -1, 0, 0, koff, klen, voff, vlen, vtype};
+  mjson64(s, n, next_cb, &d);
+  return d.len;
+}
+
 int mjson_next(const char *s, int n, int off, int *koff, int *klen, int *voff,
                int *vlen, int *vtype) {
-  struct nextdata d = {off, 0, 0, 0, 0, -1, koff, klen, voff, vlen, vtype};
-  mjson(s, n, next_cb, &d);
-  return d.len;
+  ptrdiff_t ko = 0, kl = 0, vo = 0, vl = 0;
+  int res = (int) mjson_next64(s, n, off, &ko, &kl, &vo, &vl, vtype);
+  if (res > 0) {
+    if (koff) *koff = (int) ko;
+    if (klen) *klen = (int) kl;
+    if (voff) *voff = (int) vo;
+    if (vlen) *vlen = (int) vl;
+  }
+  return res;
+}
+
+int mjson_next_cursor(struct mjson_cursor *c, const char *s, int n, int *koff,
+                      int *klen, int *voff, int *vlen, int *vtype) {
+  struct mjson_token t;
+  ptrdiff_t res, end, ko = 0, kl = 0;
+  int nt;
+  for (;;) {
+    // One token at a time, so that the state stays right after the child
+    res = mjson_run(&c->st, s, n, 1, NULL, &t, 1, 1, &nt);
+    if (nt == 0) return res < 0 ? (int) res : 0;
+    if (t.type == MJSON_TOK_KEY) {
+      ko = t.off, kl = t.len;
+      continue;
+    }
+    if ((t.type == '{' || t.type == '[') && c->st.depth == 2) {
+      // A child container: jump to its end, as mjson_walk() does
+      if ((end = mjson_skip(s, t.off, n)) < 0) return (int) end;
+      c->st.pos = end + 1;
+      c->st.depth--;
+      c->st.expecting = S_COMMA_OR_EOO;
+      t.len = end + 1 - t.off;
+      t.type = t.type == '{' ? MJSON_TOK_OBJECT : MJSON_TOK_ARRAY;
+    } else if (!MJSON_TOK_IS_VALUE(t.type) || c->st.depth != 1) {
+      if (c->st.depth == 0) return 0;  // The end, or a scalar at the top
+      continue;
+    }
+    if (kl == 0) ko = c->index;  // Arrays: koff holds the index, klen 0
+    c->index++;
+    if (koff != NULL) *koff = (int) ko;
+    if (klen != NULL) *klen = (int) kl;
+    if (voff != NULL) *voff = (int) t.off;
+    if (vlen != NULL) *vlen = (int) t.len;
+    if (vtype != NULL) *vtype = t.type;
+    return (int) (t.off + t.len);
+  }
 }
 #endif
 
@@ -727,18 +2807,28 @@ done:
 #endif
 
 #if MJSON_ENABLE_MERGE
+// The cursor jumps over nested containers without validating them. Stop at
+// an invalid one, where mjson_next() would stop, rather than copy it out
+static int mjson_merge_valid(const char *s, int voff, int vlen, int t) {
+  if (t != MJSON_TOK_OBJECT && t != MJSON_TOK_ARRAY) return 1;
+  return mjson(s + voff, vlen, NULL, NULL) == vlen;
+}
+
 int mjson_merge(const char *s, int n, const char *s2, int n2,
                 mjson_print_fn_t fn, void *userdata) {
-  int koff, klen, voff, vlen, t, t2, k, off = 0, len = 0, comma = 0;
+  int koff, klen, voff, vlen, t, t2, k, len = 0, comma = 0;
+  struct mjson_cursor c;
   if (n < 2) return len;
   len += fn("{", 1, userdata);
-  while ((off = mjson_next(s, n, off, &koff, &klen, &voff, &vlen, &t)) != 0) {
+  memset(&c, 0, sizeof(c));
+  while (mjson_next_cursor(&c, s, n, &koff, &klen, &voff, &vlen, &t) > 0) {
 #if !defined(_MSC_VER)
     char path[klen + 1];
 #else
     char *path = (char *) alloca(klen + 1);
 #endif
     const char *val;
+    if (!mjson_merge_valid(s, voff, vlen, t)) break;
     memcpy(path, "$.", 2);
     memcpy(path + 2, s + koff + 1, klen - 2);
     path[klen] = '\0';
@@ -759,14 +2849,15 @@ int mjson_merge(const char *s, int n, const char *s2, int n2,
     comma = 1;
   }
   // Add missing keys
-  off = 0;
-  while ((off = mjson_next(s2, n2, off, &koff, &klen, &voff, &vlen, &t)) != 0) {
+  memset(&c, 0, sizeof(c));
+  while (mjson_next_cursor(&c, s2, n2, &koff, &klen, &voff, &vlen, &t) > 0) {
 #if !defined(_MSC_VER)
     char path[klen + 1];
 #else
     char *path = (char *) alloca(klen + 1);
 #endif
     const char *val;
+    if (!mjson_merge_valid(s2, voff, vlen, t)) break;
     if (t == MJSON_TOK_NULL) continue;
     memcpy(path, "$.", 2);
     memcpy(path + 2, s2 + koff + 1, klen - 2);
@@ -917,30 +3008,31 @@ void jsonrpc_return_success(struct jsonrpc_request *r, const char *result_fmt,
 
 void jsonrpc_ctx_process(struct jsonrpc_ctx *ctx, const char *buf, int len,
                          mjson_print_fn_t fn, void *fndata, void *ud) {
-  const char *result = NULL, *error = NULL;
-  int result_sz = 0, error_sz = 0;
+  static const char *paths[] = {"$.result", "$.error", "$.method", "$.id",
+                                 "$.params"};
+  struct mjson_hit h[5];
   struct jsonrpc_method *m = NULL;
   struct jsonrpc_request r = {ctx, buf, len, 0, 0, 0, 0, 0, 0, fn, fndata, ud};
 
+  mjson_find_many(buf, len, paths, 5, h);
+
   // Is is a response frame?
-  mjson_find(buf, len, "$.result", &result, &result_sz);
-  if (result == NULL) mjson_find(buf, len, "$.error", &error, &error_sz);
-  if (result_sz > 0 || error_sz > 0) {
+  if (h[0].len > 0 || h[1].len > 0) {
     if (ctx->response_cb) ctx->response_cb(buf, len, ctx->response_cb_data);
     return;
   }
 
   // Method must exist and must be a string
-  if (mjson_find(buf, len, "$.method", &r.method, &r.method_len) !=
-      MJSON_TOK_STRING) {
+  if (h[2].tok != MJSON_TOK_STRING) {
     mjson_printf(fn, fndata, "{\"error\":{\"code\":-32700,\"message\":%.*Q}}\n",
                  len, buf);
     return;
   }
+  r.method = h[2].ptr, r.method_len = h[2].len;
 
   // id and params are optional
-  mjson_find(buf, len, "$.id", &r.id, &r.id_len);
-  mjson_find(buf, len, "$.params", &r.params, &r.params_len);
+  r.id = h[3].ptr, r.id_len = h[3].len;
+  r.params = h[4].ptr, r.params_len = h[4].len;
 
   for (m = ctx->methods; m != NULL; m = m->next) {
     if (mjson_globmatch(m->method, m->method_sz, r.method + 1,
@@ -23,6 +23,7 @@
 #define MJSON_H
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -55,6 +56,27 @@
 #define MJSON_ENABLE_NEXT 0
 #endif
 
+#ifndef MJSON_ENABLE_INDEX
+#define MJSON_ENABLE_INDEX 0
+#endif
+
+#ifndef MJSON_ENABLE_CACHE
+#define MJSON_ENABLE_CACHE 0
+#endif
+
+#ifndef MJSON_ENABLE_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MJSON_ENABLE_SIMD 1
+#else
+#define MJSON_ENABLE_SIMD 0
+#endif
+#endif
+
+#ifndef MJSON_BASE64_CHUNK
+#define MJSON_BASE64_CHUNK 256  // Digits per mjson_base64_dec_fn() callback
+#endif
+
 #ifndef MJSON_RPC_LIST_NAME
 #define MJSON_RPC_LIST_NAME "rpc.list"
 #endif
@@ -70,6 +92,7 @@ extern "C" {
 enum {
   MJSON_ERROR_INVALID_INPUT = -1,
   MJSON_ERROR_TOO_DEEP = -2,
+  MJSON_ERROR_TOO_LONG = -3,
 };
 
 enum mjson_tok {
@@ -86,22 +109,196 @@ enum mjson_tok {
 #define MJSON_TOK_IS_VALUE(t) ((t) > 10 && (t) < 20)
 
 typedef int (*mjson_cb_t)(int ev, const char *s, int off, int len, void *ud);
+typedef int (*mjson_cb64_t)(int ev, const char *s, ptrdiff_t off,
+                            ptrdiff_t len, void *ud);
+
+#if defined(_MSC_VER) && _MSC_VER < 1300
+typedef __int64 mjson_int64_t;
+typedef unsigned __int64 mjson_uint64_t;
+#else
+typedef long long mjson_int64_t;
+typedef unsigned long long mjson_uint64_t;
+#endif
 
 #ifndef MJSON_MAX_DEPTH
 #define MJSON_MAX_DEPTH 20
 #endif
 
+// Tokens buffered on stack by the mjson.hpp lookups: each takes
+// sizeof(struct mjson_token), e.g. 24 bytes on 64-bit targets
+#ifndef MJSON_TOKEN_BATCH
+#if MJSON_ENABLE_SIMD
+#define MJSON_TOKEN_BATCH 16
+#else
+#define MJSON_TOKEN_BATCH 4
+#endif
+#endif
+
+// Paths mjson_find_many() looks up per pass over the document: each takes
+// about 100 bytes of stack on 64-bit targets
+#ifndef MJSON_MANY_PATHS
+#define MJSON_MANY_PATHS 8
+#endif
+
 int mjson(const char *s, int len, mjson_cb_t cb, void *ud);
+int mjson_deep(const char *s, int len, mjson_cb_t cb, void *ud,
+               unsigned char *stack, int size);
+ptrdiff_t mjson64(const char *s, ptrdiff_t len, mjson_cb64_t cb, void *ud);
+int mjson_validate(const char *s, int len, int *erroff);
+
+// Parser state, kept between calls by the resumable APIs. A zeroed struct
+// is ready to use. Open containers are stacked one bit per level, in
+// `nesting`, or in `stack` if it is set
+struct mjson_state {
+  ptrdiff_t pos;                                     // Where to resume
+  int expecting;                                     // Next token kind
+  int depth;                                         // Open containers
+  int maxdepth;                                      // `stack` size in bits
+  unsigned char *stack;                              // Caller's stack
+  unsigned char nesting[(MJSON_MAX_DEPTH + 7) / 8];  // Default stack
+};
+
+struct mjson_token {
+  int type;       // Same as the `ev` argument of mjson_cb_t
+  ptrdiff_t off;  // Token offset
+  ptrdiff_t len;  // Token length
+};
+
+int mjson_tokenize(const char *s, ptrdiff_t len, struct mjson_token *out,
+                   int cap, struct mjson_state *);
+
+enum {
+  MJSON_TOKENIZE_BRK = 1,   // Also stop after an opening bracket
+  MJSON_TOKENIZE_SKIP = 2   // First jump over the container just opened
+};
+int mjson_tokenize_ex(const char *s, ptrdiff_t len, struct mjson_token *out,
+                      int cap, struct mjson_state *, int flags);
+
+// Incremental parser for documents that arrive in chunks
+struct mjson_stream {
+  struct mjson_state state;  // Parser state
+  mjson_cb_t cb;             // Token callback
+  void *ud;                  // Callback's user data
+  char *buf;                 // Holds a token that is cut between chunks
+  int size;                  // Buffer size, i.e. the longest token allowed
+  int len;                   // Buffered length
+  int total;                 // Number of bytes fed so far
+  int result;                // Document length or error, once known
+};
+
+void mjson_stream_init(struct mjson_stream *, char *buf, int size,
+                       mjson_cb_t cb, void *ud);
+int mjson_stream_feed(struct mjson_stream *, const char *chunk, int n);
+
 enum mjson_tok mjson_find(const char *s, int len, const char *jp,
                           const char **tokptr, int *toklen);
+// JSON path split into segments, e.g. "$.a[2]" into "a" and 2
+struct mjson_path_seg {
+  const char *key;  // Key, points into the source path. NULL for indices
+  int len;          // Key length, or first array index
+  int end;          // Past the last array index
+  int flags;        // MJSON_PATH_* flags
+};
+
+enum {
+  MJSON_PATH_ANY = 1,     // "*" or "[*]", any key or index
+  MJSON_PATH_DEEP = 2,    // "..", at any depth below
+  MJSON_PATH_FILTER = 4,  // "[?(...)]", children that pass the filter terms
+};
+
+#ifndef MJSON_PATH_TERMS
+#define MJSON_PATH_TERMS 4  // Max terms in a filter, up to 8
+#endif
+
+#if MJSON_PATH_TERMS > 8
+#error "MJSON_PATH_TERMS must not exceed 8, filter results are kept in a byte"
+#endif
+
+// Filter term, e.g. "@.a.b > 5"
+struct mjson_path_term {
+  const char *key;  // Key chain "a.b", points into the source path, or NULL
+  int klen;         // Key chain length
+  int op;           // 0 tests existence, else '=', '!', '<', 'l', '>', 'g'
+  int tok;          // Literal type, MJSON_TOK_*
+  const char *val;  // String literal, without quotes
+  int vlen;         // String literal length
+  double num;       // Number literal
+  int or_;          // Starts a new group of terms joined by "||"
+};
+
+struct mjson_path {
+  int n;                                         // Number of segments
+  struct mjson_path_seg segs[MJSON_MAX_DEPTH];   // Segments
+  int nterms;                                    // Number of filter terms
+  struct mjson_path_term terms[MJSON_PATH_TERMS];  // Filter terms
+};
+
+int mjson_path_compile(const char *path, struct mjson_path *);
+enum mjson_tok mjson_find_compiled(const char *s, int len,
+                                   const struct mjson_path *,
+                                   const char **tokptr, int *toklen);
+
+int mjson_query(const char *s, int len, const char *path, mjson_cb_t cb,
+                void *ud);
+
+struct mjson_hit {
+  int tok;          // Found token, or MJSON_TOK_INVALID
+  const char *ptr;  // Found value
+  int len;          // Found value length
+};
+
+int mjson_find_many(const char *s, int len, const char **paths, int npaths,
+                    struct mjson_hit *out);
+enum mjson_tok mjson_find64(const char *s, ptrdiff_t len, const char *jp,
+                            const char **tokptr, ptrdiff_t *toklen);
+typedef int (*mjson_foreach_cb_t)(const char *s, int index, int koff,
+                                  int klen, int voff, int vlen, int vtype,
+                                  void *ud);
+int mjson_foreach(const char *s, int len, mjson_foreach_cb_t cb, void *ud);
 int mjson_get_number(const char *s, int len, const char *path, double *v);
 int mjson_get_bool(const char *s, int len, const char *path, int *v);
+int mjson_get_i64(const char *s, int len, const char *path, mjson_int64_t *v);
+int mjson_get_u64(const char *s, int len, const char *path, mjson_uint64_t *v);
 int mjson_get_string(const char *s, int len, const char *path, char *to, int n);
+int mjson_get_string_view(const char *s, int len, const char *path,
+                          const char **ptr, int *escaped);
+int mjson_unescape_inplace(char *s, int len);
 int mjson_get_hex(const char *s, int len, const char *path, char *to, int n);
+int mjson_hex_dec(const char *src, int n, char *dst, int dlen, int *erroff);
+
+enum {
+  MJSON_BIND_NUMBER,  // double
+  MJSON_BIND_INT,     // int, number truncated
+  MJSON_BIND_BOOL,    // int, 1 for true and 0 for false
+  MJSON_BIND_STRING,  // char[], unescaped and nul-terminated
+};
+
+// Struct field to bind, e.g. {"$.a.b", MJSON_BIND_INT, offsetof(T, ab),
+// sizeof(int)}. A path with a wildcard or slice, e.g. "$.a[*]", fills
+// array elements in order: size is then the array size, in bytes
+struct mjson_bind_field {
+  const char *path;  // JSON path
+  int type;          // MJSON_BIND_*
+  size_t offset;     // Field offset in the struct
+  size_t size;       // Field size
+};
+long mjson_bind(const char *s, int len, const struct mjson_bind_field *desc,
+                int n, void *obj);
 
 #if MJSON_ENABLE_NEXT
 int mjson_next(const char *s, int n, int off, int *koff, int *klen, int *voff,
                int *vlen, int *vtype);
+ptrdiff_t mjson_next64(const char *s, ptrdiff_t n, ptrdiff_t off,
+                       ptrdiff_t *koff, ptrdiff_t *klen, ptrdiff_t *voff,
+                       ptrdiff_t *vlen, int *vtype);
+
+// Iterator over the children of an object or array, zero-initialise it
+struct mjson_cursor {
+  struct mjson_state st;  // Tokenizer state, right after the last child
+  int index;              // Number of children seen
+};
+int mjson_next_cursor(struct mjson_cursor *, const char *s, int n, int *koff,
+                      int *klen, int *voff, int *vlen, int *vtype);
 #endif
 
 #if MJSON_ENABLE_BASE64
@@ -109,6 +306,82 @@ int mjson_get_base64(const char *s, int len, const char *path, char *to, int n);
 int mjson_base64_dec(const char *src, int n, char *dst, int dlen);
 #endif
 
+#if MJSON_ENABLE_INDEX
+#ifndef MJSON_INDEX_STRIDE
+#define MJSON_INDEX_STRIDE 32  // K, distance between array skip points
+#endif
+
+// One key or value of an indexed document
+struct mjson_tape_entry {
+  int off;     // Offset in the document
+  int len;     // Length, for objects and arrays including all children
+  int next;    // Index of the entry that follows this value and its children
+  int skip;    // Array elements 0, K, 2K..: index of the element K further
+  short type;  // MJSON_TOK_KEY or any of the MJSON_TOK_IS_VALUE() types
+  short depth; // Nesting level
+};
+
+struct mjson_tape {
+  struct mjson_tape_entry *entries;  // Caller-provided array of entries
+  int size;                          // Number of entries in the array
+  int n;                             // Number of entries used
+  const char *s;                     // Indexed document
+};
+
+int mjson_index(const char *s, int len, struct mjson_tape *);
+enum mjson_tok mjson_find_ix(const struct mjson_tape *, const char *path,
+                             const char **tokptr, int *toklen);
+int mjson_get_number_ix(const struct mjson_tape *, const char *path,
+                        double *v);
+int mjson_get_bool_ix(const struct mjson_tape *, const char *path, int *v);
+int mjson_get_i64_ix(const struct mjson_tape *, const char *path,
+                     mjson_int64_t *v);
+int mjson_get_u64_ix(const struct mjson_tape *, const char *path,
+                     mjson_uint64_t *v);
+int mjson_get_string_ix(const struct mjson_tape *, const char *path,
+                        char *to, int n);
+int mjson_get_hex_ix(const struct mjson_tape *, const char *path, char *to,
+                     int n);
+#if MJSON_ENABLE_BASE64
+int mjson_get_base64_ix(const struct mjson_tape *, const char *path,
+                        char *to, int n);
+#endif
+#endif  // MJSON_ENABLE_INDEX
+
+#if MJSON_ENABLE_CACHE
+#ifndef MJSON_CACHE_PATH_LEN
+#define MJSON_CACHE_PATH_LEN 32  // Longer paths are not cached
+#endif
+
+#ifndef MJSON_CACHE_WAYS
+#define MJSON_CACHE_WAYS 4  // Entries per hash bucket
+#endif
+
+// Remembered result of a mjson_find()
+struct mjson_cache_entry {
+  unsigned long doc;    // Document id
+  unsigned long ver;    // Document version
+  unsigned long used;   // Time of the last use, for LRU eviction
+  int tok;              // Found token, or MJSON_TOK_INVALID
+  int off;              // Found value offset
+  int len;              // Found value length
+  char path[MJSON_CACHE_PATH_LEN];  // Path, or empty if the entry is free
+};
+
+struct mjson_cache {
+  struct mjson_cache_entry *entries;  // Caller-provided, zeroed entries
+  int size;                           // Number of entries
+  unsigned long clock;                // Number of lookups
+  unsigned long hits;                 // Lookups found in the cache
+};
+
+enum mjson_tok mjson_find_cached(struct mjson_cache *, unsigned long doc,
+                                 unsigned long ver, const char *s, int len,
+                                 const char *path, const char **tokptr,
+                                 int *toklen);
+void mjson_cache_invalidate(struct mjson_cache *, unsigned long doc);
+#endif  // MJSON_ENABLE_CACHE
+
 #if MJSON_ENABLE_PRINT
 typedef int (*mjson_print_fn_t)(const char *buf, int len, void *userdata);
 typedef int (*mjson_vprint_fn_t)(mjson_print_fn_t, void *, va_list *);
@@ -130,6 +403,11 @@ int mjson_print_file(const char *ptr, int len, void *userdata);
 int mjson_print_fixed_buf(const char *ptr, int len, void *userdata);
 int mjson_print_dynamic_buf(const char *ptr, int len, void *userdata);
 
+#if MJSON_ENABLE_BASE64
+int mjson_base64_dec_fn(const char *src, int n, mjson_print_fn_t fn,
+                        void *fnd);
+#endif
+
 #if MJSON_ENABLE_PRETTY
 int mjson_pretty(const char *, int, const char *, mjson_print_fn_t, void *);
 #endif
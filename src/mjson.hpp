@@ -0,0 +1,209 @@
+// Copyright (c) 2018-2020 Cesanta Software Limited
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// C++20 lookups with the path as a template argument:
+//
+//   if (auto v = mjsonpp::find<"$.a.b[2]">(sv)) use(v.tok, v.str);
+//
+// The path is parsed at compile time, a malformed one fails to compile.
+// Only exact paths are accepted: ".key" and "[N]" segments.
+
+#ifndef MJSON_HPP
+#define MJSON_HPP
+
+#include "mjson.h"
+
+#if defined(__cplusplus) && __cplusplus >= 202002L
+
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+namespace mjsonpp {
+
+// A string literal usable as a template argument
+template <std::size_t N>
+struct path {
+  char str[N]{};
+  constexpr path(const char (&s)[N]) {
+    for (std::size_t i = 0; i < N; i++) str[i] = s[i];
+  }
+};
+
+// Found token and its text, tok is MJSON_TOK_INVALID if not found
+struct value {
+  enum mjson_tok tok = MJSON_TOK_INVALID;
+  std::string_view str;
+  explicit operator bool() const { return tok != MJSON_TOK_INVALID; }
+};
+
+namespace detail {
+
+struct seg {
+  int off;    // Key offset in the path, or -1 for an array index
+  int len;    // Key length, or the array index
+};
+
+// Parse up to max segments of p into out, return their number or -1
+constexpr int parse(const char *p, seg *out, int max) {
+  int n = 0, i = 1;
+  if (p[0] != '$') return -1;
+  while (p[i] != '\0') {
+    seg s{-1, 0};
+    if (p[i] == '.') {
+      s.off = ++i;
+      while (p[i] != '\0' && p[i] != '.' && p[i] != '[') i++;
+      s.len = i - s.off;
+      // Same as mjson_path_compile(): ".*" and ".." are not keys
+      if ((s.len == 1 && p[s.off] == '*') || (s.len == 0 && p[i] == '.')) {
+        return -1;
+      }
+    } else if (p[i] == '[' && p[i + 1] >= '0' && p[i + 1] <= '9') {
+      for (i++; p[i] >= '0' && p[i] <= '9'; i++) {
+        if (s.len > (INT_MAX - 9) / 10) return -1;
+        s.len = s.len * 10 + (p[i] - '0');
+      }
+      if (s.len == INT_MAX || p[i++] != ']') return -1;
+    } else {
+      return -1;  // Wildcards, slices and filters need mjson_find()
+    }
+    if (n < max) out[n] = s;
+    n++;
+  }
+  return n;
+}
+
+template <path P>
+constexpr int count() {
+  seg tmp[1]{};
+  return parse(P.str, tmp, 0);
+}
+
+template <path P>
+constexpr auto segments() {
+  constexpr int n = count<P>();
+  static_assert(n >= 0, "mjson: not an exact JSON path");
+  static_assert(n <= MJSON_MAX_DEPTH, "mjson: path is deeper than the parser");
+  std::array<seg, n> out{};
+  if constexpr (n > 0) parse(P.str, out.data(), n);
+  return out;
+}
+
+// Check a key token, quotes included, against segment I
+template <path P, std::size_t I>
+inline bool key_is(const char *k, std::ptrdiff_t len) {
+  constexpr seg g = segments<P>()[I];
+  if constexpr (g.off < 0) {
+    return false;
+  } else {
+    return len == g.len + 2 && std::memcmp(k + 1, P.str + g.off, g.len) == 0;
+  }
+}
+
+// Check a key token against segment `pos`. Every segment gets its own
+// branch, so the comparison length is a constant
+template <path P, std::size_t... I>
+inline bool key_match(int pos, [[maybe_unused]] const char *k,
+                      [[maybe_unused]] std::ptrdiff_t len,
+                      std::index_sequence<I...>) {
+  return ((pos == (int) I && key_is<P, I>(k, len)) || ...);
+}
+
+// Tokenize the container that opens with t, skipping the nested ones as
+// mjson_find() does, and return it
+inline value container(std::string_view sv, struct mjson_state *st,
+                       const struct mjson_token &t) {
+  struct mjson_token toks[MJSON_TOKEN_BATCH];
+  int flags = MJSON_TOKENIZE_BRK, k, i;
+  while ((k = mjson_tokenize_ex(sv.data(), (std::ptrdiff_t) sv.size(), toks,
+                                MJSON_TOKEN_BATCH, st, flags)) > 0) {
+    i = flags & MJSON_TOKENIZE_SKIP ? 1 : 0;
+    for (flags = MJSON_TOKENIZE_BRK; i < k; i++) {
+      if (toks[i].type == '{' || toks[i].type == '[') {
+        flags |= MJSON_TOKENIZE_SKIP;
+      } else if (toks[i].type == '}' || toks[i].type == ']') {
+        return {(enum mjson_tok) t.type,
+                sv.substr((std::size_t) t.off,
+                          (std::size_t) (toks[i].off - t.off + 1))};
+      }
+    }
+  }
+  return {};
+}
+
+}  // namespace detail
+
+// Same as mjson_find(), but the path is compiled in. Non-matching
+// containers are skipped without being tokenized
+template <path P>
+inline value find(std::string_view sv) {
+  constexpr auto segs = detail::segments<P>();
+  constexpr int n = (int) segs.size();
+  constexpr auto seq = std::make_index_sequence<segs.size()>();
+  const char *s = sv.data();
+  std::ptrdiff_t len = (std::ptrdiff_t) sv.size();
+  struct mjson_token toks[MJSON_TOKEN_BATCH];
+  struct mjson_state st;
+  int pos = 0;       // Segments matched, that is containers entered
+  int index = 0;     // Elements seen in the current array
+  bool want = true;  // The next value is the one segs[0..pos) name
+  int flags = MJSON_TOKENIZE_BRK, k, i;
+  std::memset(&st, 0, sizeof(st));
+  while ((k = mjson_tokenize_ex(s, len, toks, MJSON_TOKEN_BATCH, &st,
+                                flags)) > 0) {
+    // A jump lands on the closing bracket of the skipped container
+    i = flags & MJSON_TOKENIZE_SKIP ? 1 : 0;
+    for (flags = MJSON_TOKENIZE_BRK; i < k; i++) {
+      const struct mjson_token &t = toks[i];
+      if (t.type == MJSON_TOK_KEY) {
+        want = detail::key_match<P>(pos - 1, s + t.off, t.len, seq);
+      } else if (t.type == ',') {
+        // Only the containers on the path are tokenized, this is one
+        want = segs[pos - 1].off < 0 && ++index == segs[pos - 1].len;
+      } else if (t.type == '{' || t.type == '[') {
+        // Opening brackets end a batch, so this is the last token in it
+        flags |= MJSON_TOKENIZE_SKIP;
+        if (!want) break;
+        if (pos == n) return detail::container(sv, &st, t);
+        if ((segs[pos].off < 0) != (t.type == '[')) return {};
+        index = 0;
+        want = segs[pos].off < 0 && segs[pos].len == 0;
+        pos++;
+        flags = MJSON_TOKENIZE_BRK;
+      } else if (t.type == '}' || t.type == ']') {
+        return {};  // Left a container on the path
+      } else if (MJSON_TOK_IS_VALUE(t.type) && want) {
+        if (pos < n) return {};
+        return {(enum mjson_tok) t.type,
+                sv.substr((std::size_t) t.off, (std::size_t) t.len)};
+      }
+    }
+  }
+  return {};
+}
+
+}  // namespace mjsonpp
+
+#endif  // __cplusplus >= 202002L
+#endif  // MJSON_HPP
@@ -2,6 +2,7 @@
 // All rights reserved
 
 #include "mjson.h"
+#include "mjson.hpp"
 
 static int s_num_tests = 0;
 static int s_num_errors = 0;
@@ -15,6 +16,11 @@ static int s_num_errors = 0;
     }                                                        \
   } while (0)
 
+static int log_cb(int ev, const char *s, int off, int len, void *ud) {
+  mjson_printf(mjson_print_fixed_buf, ud, "%d:%.*s|", ev, len, s + off);
+  return 0;
+}
+
 static void test_cb(void) {
   const char *str;
   {
@@ -74,6 +80,233 @@ static void test_cb(void) {
   ASSERT(mjson(str, 10, NULL, NULL) == 10);
 
   ASSERT(mjson("]", 1, NULL, NULL) == MJSON_ERROR_INVALID_INPUT);
+
+  {
+    // Deep documents with a caller-provided, bit-packed stack
+    static char doc[1024 * 6 + 10];
+    unsigned char stack[128];
+    int i, n = 0;
+    for (i = 0; i < 1024; i++) n += sprintf(doc + n, i & 1 ? "{\"a\":" : "[");
+    doc[n++] = '1';
+    for (i = 1023; i >= 0; i--) n += sprintf(doc + n, i & 1 ? "}" : "]");
+    ASSERT(mjson(doc, n, NULL, NULL) == MJSON_ERROR_TOO_DEEP);
+    ASSERT(mjson_deep(doc, n, NULL, NULL, stack, sizeof(stack)) == n);
+    ASSERT(mjson_deep(doc, n, NULL, NULL, stack, 127) == MJSON_ERROR_TOO_DEEP);
+    doc[n - 2] = ']';  // Closes the wrong container
+    ASSERT(mjson_deep(doc, n, NULL, NULL, stack, sizeof(stack)) ==
+           MJSON_ERROR_INVALID_INPUT);
+  }
+
+  {
+    // Whitespace runs of any length must produce identical callback events
+    const char *toks[] = {"{", "\"a\"", ":", "[", "1", ",", "true",
+                          "]",  ",", "\"b\"", ":", "{",  "}",  "}"};
+    const char *pad = " \t\r\n";
+    char doc[1200], log1[300], log2[300];
+    size_t i, k, j;
+    for (k = 0; k < 70; k += 3) {
+      struct mjson_fixedbuf fb1 = {log1, sizeof(log1), 0};
+      struct mjson_fixedbuf fb2 = {log2, sizeof(log2), 0};
+      int n = 0, m = 0;
+      for (i = 0; i < sizeof(toks) / sizeof(toks[0]); i++) {
+        for (j = 0; j < k; j++) doc[n++] = pad[(i + j) % 4];
+        n += sprintf(doc + n, "%s", toks[i]);
+      }
+      ASSERT(mjson(doc, n, log_cb, &fb1) == n);
+      for (i = m = 0; i < sizeof(toks) / sizeof(toks[0]); i++) {
+        m += sprintf(doc + m, "%s", toks[i]);
+      }
+      ASSERT(mjson(doc, m, log_cb, &fb2) == m);
+      ASSERT(fb1.len == fb2.len && strcmp(log1, log2) == 0);
+    }
+  }
+
+  {
+    // Escapes, NULs and unterminated strings at every block boundary
+    char buf[100];
+    int i;
+    for (i = 1; i < 70; i++) {
+      memset(buf, 'x', sizeof(buf));
+      buf[0] = buf[i + 1] = '"';
+      ASSERT(mjson(buf, i + 2, NULL, NULL) == i + 2);
+      ASSERT(mjson(buf, i + 1, NULL, NULL) == MJSON_ERROR_INVALID_INPUT);
+      buf[i] = '\\';
+      ASSERT(mjson(buf, i + 2, NULL, NULL) == MJSON_ERROR_INVALID_INPUT);
+      buf[i + 2] = '"';
+      ASSERT(mjson(buf, i + 3, NULL, NULL) == i + 3);
+      buf[i] = '\0';
+      ASSERT(mjson(buf, i + 2, NULL, NULL) == MJSON_ERROR_INVALID_INPUT);
+      buf[i] = '\\', buf[i + 1] = 'n';
+      ASSERT(mjson(buf, i + 3, NULL, NULL) == i + 3);
+    }
+  }
+}
+
+static void test_stream(void) {
+  const char *docs[] = {
+      "{\"a\": true, \"bb\": [ null, -3.25e+2, false ], \"c\\\"\": {}}",
+      "[1, 2 ,  null, true,false,\"fo\\\\o\"  ]",
+      "\"just a string\"",
+  };
+  char log1[300], log2[300], buf[20];
+  size_t i;
+  int j, k;
+  for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+    const char *s = docs[i];
+    int n = (int) strlen(s);
+    struct mjson_fixedbuf fb1 = {log1, sizeof(log1), 0};
+    ASSERT(mjson(s, n, log_cb, &fb1) == n);
+    // Feed the document in chunks of every size
+    for (k = 1; k <= n; k++) {
+      struct mjson_fixedbuf fb2 = {log2, sizeof(log2), 0};
+      struct mjson_stream st;
+      int res = 0;
+      mjson_stream_init(&st, buf, sizeof(buf), log_cb, &fb2);
+      for (j = 0; j < n && res == 0; j += k) {
+        res = mjson_stream_feed(&st, s + j, j + k > n ? n - j : k);
+      }
+      ASSERT(res == n);
+      ASSERT(fb1.len == fb2.len && strcmp(log1, log2) == 0);
+      ASSERT(mjson_stream_feed(&st, "[", 1) == n);  // Done, no more parsing
+    }
+  }
+
+  {
+    // A top-level number is complete only when the input ends
+    struct mjson_stream st;
+    mjson_stream_init(&st, buf, sizeof(buf), NULL, NULL);
+    ASSERT(mjson_stream_feed(&st, "12", 2) == 0);
+    ASSERT(mjson_stream_feed(&st, "3", 1) == 0);
+    ASSERT(mjson_stream_feed(&st, NULL, 0) == 3);
+  }
+
+  {
+    struct mjson_stream st;
+    mjson_stream_init(&st, buf, sizeof(buf), NULL, NULL);
+    ASSERT(mjson_stream_feed(&st, "[tr", 3) == 0);
+    ASSERT(mjson_stream_feed(&st, "ux]", 3) == MJSON_ERROR_INVALID_INPUT);
+    mjson_stream_init(&st, buf, sizeof(buf), NULL, NULL);
+    ASSERT(mjson_stream_feed(&st, "[1,", 3) == 0);
+    ASSERT(mjson_stream_feed(&st, NULL, 0) == MJSON_ERROR_INVALID_INPUT);
+  }
+
+  {
+    // Tokens longer than the buffer are rejected
+    struct mjson_stream st;
+    const char *s = "[\"0123456789abcdefghijk\"]";
+    mjson_stream_init(&st, buf, sizeof(buf), NULL, NULL);
+    ASSERT(mjson_stream_feed(&st, s, 5) == 0);
+    ASSERT(mjson_stream_feed(&st, s + 5, 10) == 0);
+    ASSERT(mjson_stream_feed(&st, s + 15, 10) == MJSON_ERROR_TOO_LONG);
+    mjson_stream_init(&st, buf, sizeof(buf), NULL, NULL);
+    ASSERT(mjson_stream_feed(&st, s, (int) strlen(s)) == (int) strlen(s));
+  }
+}
+
+static void test_tokenize(void) {
+  const char *s = "{\"a\": [1, true, {}], \"b\": \"x\"}";
+  int n = (int) strlen(s), res, cap;
+  char log1[200], log2[200];
+  struct mjson_fixedbuf fb1 = {log1, sizeof(log1), 0};
+  struct mjson_token toks[3];
+  ASSERT(mjson(s, n, log_cb, &fb1) == n);
+  // Any batch size yields the same tokens as the callback API
+  for (cap = 1; cap <= 3; cap++) {
+    struct mjson_fixedbuf fb2 = {log2, sizeof(log2), 0};
+    struct mjson_state st;
+    memset(&st, 0, sizeof(st));
+    while ((res = mjson_tokenize(s, n, toks, cap, &st)) > 0) {
+      int i;
+      ASSERT(res <= cap);
+      for (i = 0; i < res; i++) {
+        log_cb(toks[i].type, s, toks[i].off, toks[i].len, &fb2);
+      }
+    }
+    ASSERT(res == 0 && st.pos == n);
+    ASSERT(fb1.len == fb2.len && strcmp(log1, log2) == 0);
+    ASSERT(mjson_tokenize(s, n, toks, cap, &st) == 0);
+  }
+
+  {
+    // Tokens that precede an error are returned first
+    struct mjson_state st;
+    memset(&st, 0, sizeof(st));
+    ASSERT(mjson_tokenize("[1 x]", 5, toks, 3, &st) == 2);
+    ASSERT(toks[1].type == MJSON_TOK_NUMBER && toks[1].off == 1);
+    ASSERT(mjson_tokenize("[1 x]", 5, toks, 3, &st) == -1);
+    ASSERT(st.pos == 3);
+    ASSERT(mjson_tokenize("[1 x]", 5, toks, 3, &st) == -1);
+  }
+
+  {
+    // Stop after opening brackets, and jump over the container just opened
+    const char *d = "[{\"a\": [1, 2]}, 3]";
+    struct mjson_state st;
+    memset(&st, 0, sizeof(st));
+    n = (int) strlen(d);
+    ASSERT(mjson_tokenize_ex(d, n, toks, 3, &st, MJSON_TOKENIZE_BRK) == 1);
+    ASSERT(toks[0].type == '[' && st.pos == 1);
+    ASSERT(mjson_tokenize_ex(d, n, toks, 3, &st, MJSON_TOKENIZE_BRK) == 1);
+    ASSERT(toks[0].type == '{' && toks[0].off == 1);
+    ASSERT(mjson_tokenize_ex(d, n, toks, 3, &st, MJSON_TOKENIZE_SKIP) == 3);
+    ASSERT(toks[0].type == '}' && toks[0].off == 13);
+    ASSERT(toks[1].type == ',' && toks[2].type == MJSON_TOK_NUMBER);
+    ASSERT(mjson_tokenize_ex(d, n, toks, 3, &st, MJSON_TOKENIZE_BRK) == 1);
+    ASSERT(toks[0].type == ']' && st.pos == n);
+    ASSERT(mjson_tokenize_ex(d, n, toks, 3, &st, 0) == 0);
+    // Nothing to jump over
+    ASSERT(mjson_tokenize_ex(d, n, toks, 3, &st, MJSON_TOKENIZE_SKIP) == -1);
+    memset(&st, 0, sizeof(st));
+    ASSERT(mjson_tokenize_ex(d, n, toks, 3, &st, MJSON_TOKENIZE_SKIP) == -1);
+    ASSERT(mjson_tokenize_ex("[[1", 3, toks, 3, &st, MJSON_TOKENIZE_BRK) == 1);
+    ASSERT(mjson_tokenize_ex("[[1", 3, toks, 3, &st, MJSON_TOKENIZE_BRK) == 1);
+    ASSERT(mjson_tokenize_ex("[[1", 3, toks, 3, &st, MJSON_TOKENIZE_SKIP) < 0);
+    // The whole document, reported one token at a time
+    memset(&st, 0, sizeof(st));
+    ASSERT(mjson_tokenize_ex(d, n, toks, 1, &st, MJSON_TOKENIZE_BRK) == 1);
+    ASSERT(mjson_tokenize_ex(d, n, toks, 1, &st, MJSON_TOKENIZE_SKIP) == 1);
+    ASSERT(toks[0].type == ']' && toks[0].off == n - 1 && st.pos == n);
+    ASSERT(mjson_tokenize_ex(d, n, toks, 1, &st, 0) == 0);
+  }
+}
+
+static void test_validate(void) {
+  const char *bad[] = {
+      "\xc3",              // Truncated
+      "\x80",              // Stray continuation byte
+      "\xc0\xaf",          // Overlong
+      "\xe0\x80\xaf",      // Overlong
+      "\xed\xa0\x80",      // Surrogate
+      "\xf4\x90\x80\x80",  // Above U+10FFFF
+      "\xf8\x88\x80\x80",  // 5-byte form
+      "\xe2\x82x",         // Bad continuation
+  };
+  char doc[200];
+  size_t i;
+  int n, k, off;
+  ASSERT(mjson_validate("{\"a\":[1,true]}", 14, NULL) == 14);
+  ASSERT(mjson_validate("{\"a\":[1,true]", 13, &off) == -1 && off == 13);
+  ASSERT(mjson_validate("[1, 2 x", 7, &off) == -1 && off == 6);
+  ASSERT(mjson_validate("[\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"]", 13,
+                        NULL) == 13);
+  ASSERT(mjson_validate("[1 \x80]", 5, &off) == -1 && off == 3);
+  // An earlier UTF-8 error wins over a later syntax error
+  ASSERT(mjson_validate("[\"\xc3(\", x]", 9, &off) == -1 && off == 2);
+
+  // Short and long strings take the scalar and the vector paths
+  for (k = 0; k < 2; k++) {
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+      int at = k ? 70 : 3, m = (int) strlen(bad[i]);
+      memset(doc, 'x', sizeof(doc));
+      memcpy(doc, "[1,\"", 4);
+      memcpy(doc + at + 1, bad[i], m);
+      n = at + m + 40;
+      memcpy(doc + n - 2, "\"]", 2);
+      ASSERT(mjson_validate(doc, n, &off) == -1 && off == at + 1);
+      memcpy(doc + at + 1, "\xf0\x9f\x98\x80", 4);
+      ASSERT(mjson_validate(doc, n, &off) == n);
+    }
+  }
 }
 
 static void test_find(void) {
@@ -117,6 +350,209 @@ static void test_find(void) {
   ASSERT(mjson_find(str, strlen(str), "$.a1[1].x", &p, &n) == MJSON_TOK_NUMBER);
   ASSERT(mjson_find(str, strlen(str), "$.a1[2].x", &p, &n) ==
          MJSON_TOK_INVALID);
+
+  {
+    // The ptrdiff_t flavour agrees with the int one
+    ptrdiff_t n64 = 0;
+    ASSERT(mjson64(str, (ptrdiff_t) strlen(str), NULL, NULL) ==
+           (ptrdiff_t) strlen(str));
+    ASSERT(mjson_find64(str, (ptrdiff_t) strlen(str), "$.a2[1]", &p, &n64) ==
+           MJSON_TOK_OBJECT);
+    ASSERT(n64 == 7 && memcmp(p, "{\"x\":4}", 7) == 0);
+    ASSERT(mjson_find64(str, 10, "$.a2", &p, &n64) == MJSON_TOK_INVALID);
+  }
+
+  {
+    // One pass gives the same results as one mjson_find() per path
+    const char *paths[] = {"$.a2[1].x", "$.b", "$.a1", "$",
+                           "$.a1[0]",   "x",   "$.a2[0].x"};
+    struct mjson_hit h[7];
+    int i, len = (int) strlen(str), found = 0;
+    for (i = 0; i < 7; i++) {
+      h[i].tok = -1;
+      if (mjson_find(str, len, paths[i], &p, &n) != MJSON_TOK_INVALID) found++;
+    }
+    ASSERT(mjson_find_many(str, len, paths, 7, h) == found);
+    for (i = 0; i < 7; i++) {
+      p = NULL, n = 0;
+      ASSERT(h[i].tok == (int) mjson_find(str, len, paths[i], &p, &n));
+      ASSERT(h[i].ptr == p && h[i].len == n);
+    }
+    // Found values are reported even if the document breaks later
+    ASSERT(mjson_find_many(str, 20, paths, 7, h) == 1);
+    ASSERT(h[4].tok == MJSON_TOK_OBJECT && h[4].len == 7);
+    ASSERT(h[2].tok == MJSON_TOK_INVALID && h[2].ptr == NULL);
+  }
+
+  {
+    // More paths than one pass takes, wildcards among them
+    const char *paths[] = {"$.a2[1].x", "$.a2[1]", "$.a1[*]", "$..x",
+                           "$.a1[0]",   "$[0]",    "$",       "$.a2[0].x",
+                           "$.a1[1:]",  "$.a2[9]", "$.a1"};
+    struct mjson_hit h[11];
+    int i, len = (int) strlen(str), found = 0;
+    for (i = 0; i < 11; i++) {
+      if (mjson_find(str, len, paths[i], &p, &n) != MJSON_TOK_INVALID) found++;
+    }
+    ASSERT(found > MJSON_MANY_PATHS);
+    ASSERT(mjson_find_many(str, len, paths, 11, h) == found);
+    for (i = 0; i < 11; i++) {
+      p = NULL, n = 0;
+      ASSERT(h[i].tok == (int) mjson_find(str, len, paths[i], &p, &n));
+      ASSERT(h[i].ptr == p && h[i].len == n);
+    }
+  }
+
+  {
+    // Non-matching containers are jumped over, brackets in strings ignored
+    const char *paths[] = {"$.p.q[1]", "$.m.id"};
+    struct mjson_hit h[2];
+    const char *doc =
+        "{\"p\":{\"s\":\"}]\\\"{[\",\"q\":[[\"]\"],{\"a\":[]}]},"
+        "\"z\":[[1],{\"m\":2}],\"m\":{\"x\":{},\"id\":7}}";
+    ASSERT(mjson_find(doc, strlen(doc), "$.m.id", &p, &n) == MJSON_TOK_NUMBER);
+    ASSERT(n == 1 && *p == '7');
+    ASSERT(mjson_find(doc, strlen(doc), "$.z[1].m", &p, &n) ==
+           MJSON_TOK_NUMBER);
+    ASSERT(n == 1 && *p == '2');
+    ASSERT(mjson_find(doc, strlen(doc), "$.m", &p, &n) == MJSON_TOK_OBJECT);
+    ASSERT(n == 15);
+    ASSERT(mjson_find(doc, strlen(doc), "$.x", &p, &n) == MJSON_TOK_INVALID);
+    ASSERT(mjson_find_many(doc, strlen(doc), paths, 2, h) == 2);
+    ASSERT(h[0].tok == MJSON_TOK_OBJECT && h[0].len == 8);
+    ASSERT(h[1].tok == MJSON_TOK_NUMBER && *h[1].ptr == '7');
+    ASSERT(mjson_find("{\"a\":[\"]", 8, "$.b", &p, &n) == MJSON_TOK_INVALID);
+  }
+
+  {
+    // Keys are looked up only in the value the path leads to, not in the
+    // ones that follow it
+    const char *docs[] = {"[\"x\",{\"a\":1}]", "[{},{\"a\":1}]",
+                          "[[2],{\"a\":1}]"};
+    const char *paths[] = {"$[0].a", "$[1].a"};
+    const char *s1 = "{\"b\":[\"x\",{\"a\":1}]}";
+    const char *s2 = "{\"a\":[5],\"x\":[{\"b\":1}]}";
+    struct mjson_hit h[2];
+    int i;
+    for (i = 0; i < 3; i++) {
+      int len = (int) strlen(docs[i]);
+      ASSERT(mjson_find(docs[i], len, "$[0].a", &p, &n) == MJSON_TOK_INVALID);
+      ASSERT(mjson_find(docs[i], len, "$[1].a", &p, &n) == MJSON_TOK_NUMBER);
+      ASSERT(mjson_find_many(docs[i], len, paths, 2, h) == 1);
+      ASSERT(h[0].tok == MJSON_TOK_INVALID && h[1].tok == MJSON_TOK_NUMBER);
+    }
+    ASSERT(mjson_find(s1, strlen(s1), "$.b[0].a", &p, &n) ==
+           MJSON_TOK_INVALID);
+    ASSERT(mjson_find(s2, strlen(s2), "$.a[0].b", &p, &n) ==
+           MJSON_TOK_INVALID);
+    ASSERT(mjson_find(s2, strlen(s2), "$.x[0].b", &p, &n) ==
+           MJSON_TOK_NUMBER);
+  }
+
+  {
+    struct mjson_path cp;
+    ASSERT(mjson_path_compile("$", &cp) == 0);
+    ASSERT(mjson_path_compile("$.a1[12].x", &cp) == 3);
+    ASSERT(cp.segs[0].len == 2 && memcmp(cp.segs[0].key, "a1", 2) == 0);
+    ASSERT(cp.segs[1].key == NULL && cp.segs[1].len == 12);
+    ASSERT(cp.segs[2].len == 1 && cp.segs[2].key[0] == 'x');
+    ASSERT(mjson_path_compile("a", &cp) == MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_path_compile("$[", &cp) == MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_path_compile("$[1", &cp) == MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_path_compile("$[x]", &cp) == MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_path_compile("$x", &cp) == MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_path_compile("$[99999999999]", &cp) ==
+           MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_path_compile("$.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a",
+                              &cp) == MJSON_ERROR_TOO_DEEP);
+
+    ASSERT(mjson_path_compile("$.a2[1].x", &cp) == 3);
+    ASSERT(mjson_find_compiled(str, strlen(str), &cp, &p, &n) ==
+           MJSON_TOK_NUMBER);
+    ASSERT(n == 1 && *p == '4');
+    ASSERT(mjson_path_compile("$.a2[2]", &cp) == 2);
+    ASSERT(mjson_find_compiled(str, strlen(str), &cp, &p, &n) ==
+           MJSON_TOK_INVALID);
+  }
+}
+
+static void test_query(void) {
+  const char *s =
+      "{\"devices\":[{\"id\":1,\"temp\":20.5},{\"id\":2},"
+      "{\"id\":3,\"temp\":-4,\"sub\":{\"temp\":true}}],"
+      "\"temp\":null,\"x\":[10,11,12,13]}";
+  int n = (int) strlen(s), len;
+  char log[200];
+  struct mjson_fixedbuf fb = {log, sizeof(log), 0};
+  const char *p;
+#define QUERY(path) (fb.len = 0, mjson_query(s, n, (path), log_cb, &fb))
+  ASSERT(QUERY("$.devices[*].temp") == 2);
+  ASSERT(strcmp(log, "12:20.5|12:-4|") == 0);
+  ASSERT(QUERY("$..temp") == 4);
+  ASSERT(strcmp(log, "12:20.5|12:-4|13:true|15:null|") == 0);
+  ASSERT(QUERY("$.devices.*.id") == 3);
+  ASSERT(strcmp(log, "12:1|12:2|12:3|") == 0);
+  ASSERT(QUERY("$.x[1:3]") == 2);
+  ASSERT(strcmp(log, "12:11|12:12|") == 0);
+  ASSERT(QUERY("$.x[2:]") == 2 && strcmp(log, "12:12|12:13|") == 0);
+  ASSERT(QUERY("$.x[:1]") == 1 && strcmp(log, "12:10|") == 0);
+  ASSERT(QUERY("$.x[3]") == 1 && strcmp(log, "12:13|") == 0);
+  ASSERT(QUERY("$.devices[2].sub") == 1);
+  ASSERT(strcmp(log, "123:{\"temp\":true}|") == 0);
+  // Containers are reported when they close, after any matches inside
+  ASSERT(QUERY("$.devices[2]..*") == 4);
+  ASSERT(strcmp(log, "12:3|12:-4|13:true|123:{\"temp\":true}|") == 0);
+  ASSERT(QUERY("$..[1]") == 2 && strcmp(log, "123:{\"id\":2}|12:11|") == 0);
+  ASSERT(QUERY("$") == 1 && fb.len == (int) strlen("123:|") + n);
+  ASSERT(QUERY("$.nope[*]") == 0);
+
+  // Filters
+  ASSERT(QUERY("$.devices[?(@.temp>0)]") == 1);
+  ASSERT(strcmp(log, "123:{\"id\":1,\"temp\":20.5}|") == 0);
+  ASSERT(QUERY("$.devices[?(@.id==2 || @.temp<0)].id") == 2);
+  ASSERT(strcmp(log, "12:2|12:3|") == 0);
+  ASSERT(QUERY("$.devices[?(@.id>=2 && @.temp)].id") == 1);
+  ASSERT(strcmp(log, "12:3|") == 0);
+  ASSERT(QUERY("$.devices[?(@.sub.temp==true)].id") == 1);
+  ASSERT(strcmp(log, "12:3|") == 0);
+  ASSERT(QUERY("$.devices[?(@.id != 1)].temp") == 1);
+  ASSERT(strcmp(log, "12:-4|") == 0);
+  ASSERT(QUERY("$.x[?(@>11)]") == 2 && strcmp(log, "12:12|12:13|") == 0);
+  ASSERT(QUERY("$.x[?(@<=10 || @==13)]") == 2);
+  ASSERT(strcmp(log, "12:10|12:13|") == 0);
+  ASSERT(mjson_query("[{\"a\":\"x\"},{\"a\":\"y\"}]", 21,
+                     "$[?(@.a=='y')].a", NULL, NULL) == 1);
+  ASSERT(mjson_query("[{\"a\":\"x\"},{\"a\":\"y\"}]", 21,
+                     "$[?(@.a==\"y\" || @.a==null)]", NULL, NULL) == 1);
+  ASSERT(QUERY("$.devices[?(@.temp>'a')]") == MJSON_ERROR_INVALID_INPUT);
+  ASSERT(QUERY("$.devices[?(@.temp>0)") == MJSON_ERROR_INVALID_INPUT);
+  ASSERT(QUERY("$.devices[?(@.a)][?(@.b)]") == MJSON_ERROR_INVALID_INPUT);
+  ASSERT(QUERY("$.x[?(@==1||@==2||@==3||@==4||@==5)]") ==
+         MJSON_ERROR_INVALID_INPUT);
+  ASSERT(QUERY("$.x[") == MJSON_ERROR_INVALID_INPUT);
+  ASSERT(mjson_query("[1,2", 4, "$[*]", NULL, NULL) ==
+         MJSON_ERROR_INVALID_INPUT);
+#undef QUERY
+
+  // mjson_find() returns the first match
+  ASSERT(mjson_find(s, n, "$..temp", &p, &len) == MJSON_TOK_NUMBER);
+  ASSERT(len == 4 && memcmp(p, "20.5", 4) == 0);
+  // ".." is recursive descent, not an empty key
+  ASSERT(mjson_find("{\"y\":{\"x\":2},\"\":{\"x\":1}}", 24, "$..x", &p,
+                    &len) == MJSON_TOK_NUMBER);
+  ASSERT(len == 1 && *p == '2');
+  ASSERT(mjson_find("[[{\"a\":{\"x\":1}}]]", 17, "$[0][0]..x", &p, &len) ==
+         MJSON_TOK_NUMBER);
+  ASSERT(len == 1 && *p == '1');
+  ASSERT(mjson_find(s, n, "$.devices[2]..temp", &p, &len) ==
+         MJSON_TOK_NUMBER);
+  ASSERT(len == 2 && memcmp(p, "-4", 2) == 0);
+  ASSERT(mjson_find(s, n, "$.x[2:]", &p, &len) == MJSON_TOK_NUMBER);
+  ASSERT(len == 2 && memcmp(p, "12", 2) == 0);
+  ASSERT(mjson_find(s, n, "$.*[9]", &p, &len) == MJSON_TOK_INVALID);
+  ASSERT(mjson_find(s, n, "$.devices[?(@.temp<0)].id", &p, &len) ==
+         MJSON_TOK_NUMBER);
+  ASSERT(len == 1 && *p == '3');
 }
 
 static void test_get_number(void) {
@@ -173,6 +609,42 @@ static void test_get_number(void) {
   ASSERT(mjson_get_number(str, 17, "$[2].a[2]", &v) == 0);
   str = "{\"a\":3,\"ab\":2}";
   ASSERT(mjson_get_number(str, 14, "$.ab", &v) == 1 && v == 2);
+
+  {
+    // Values must match strtod() bit for bit
+    const char *nums[] = {"0",
+                          "-0",
+                          "0.1",
+                          "3.14159",
+                          "-2.5e-3",
+                          "1E+2",
+                          "1e22",
+                          "1e23",
+                          "9007199254740993",
+                          "123456789012345678901234567890",
+                          "0.000000000000000000001",
+                          "2.2250738585072014e-308",
+                          "-1.7976931348623157e308",
+                          "4.9e-324"};
+    size_t i;
+    for (i = 0; i < sizeof(nums) / sizeof(nums[0]); i++) {
+      int n = (int) strlen(nums[i]);
+      ASSERT(mjson(nums[i], n, NULL, NULL) == n);
+      ASSERT(mjson_get_number(nums[i], n, "$", &v) == 1);
+      ASSERT(v == strtod(nums[i], NULL));
+    }
+  }
+
+  {
+    // Things strtod() accepts, but JSON does not
+    const char *bad[] = {"[-]",   "[1.]",   "[01]", "[1e]",  "[1e+]",
+                         "[.5]",  "[+1]",   "[-a]", "[inf]", "[-inf]",
+                         "[nan]", "[0x10]", "[1.e2]"};
+    size_t i;
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+      ASSERT(mjson(bad[i], strlen(bad[i]), NULL, NULL) < 0);
+    }
+  }
 }
 
 static void test_get_bool(void) {
@@ -187,6 +659,34 @@ static void test_get_bool(void) {
   ASSERT(mjson_get_bool(s, strlen(s), "$.state.lights", &v) == 1 && v == 1);
 }
 
+static void test_get_int64(void) {
+  const char *s =
+      "[9007199254740993,-9223372036854775808,9223372036854775807,"
+      "9223372036854775808,18446744073709551615,18446744073709551616,"
+      "-1,1.5,2e3,\"7\",-0]";
+  int n = (int) strlen(s);
+  mjson_int64_t i = 0;
+  mjson_uint64_t u = 0;
+  ASSERT(mjson_get_i64(s, n, "$[0]", &i) == 1);
+  ASSERT(i / 10 == 900719925474099 && i % 10 == 3);  // 2^53 + 1
+  ASSERT(mjson_get_i64(s, n, "$[1]", &i) == 1);
+  ASSERT(i < 0 && (mjson_uint64_t) i == (mjson_uint64_t) 1 << 63);
+  ASSERT(mjson_get_i64(s, n, "$[2]", &i) == 1);
+  ASSERT(i > 0 && (mjson_uint64_t) i == ((mjson_uint64_t) 1 << 63) - 1);
+  ASSERT(mjson_get_i64(s, n, "$[3]", &i) == -1);
+  ASSERT(mjson_get_u64(s, n, "$[3]", &u) == 1 && u == (mjson_uint64_t) i + 1);
+  ASSERT(mjson_get_u64(s, n, "$[4]", &u) == 1 && u + 1 == 0);
+  ASSERT(mjson_get_u64(s, n, "$[5]", &u) == -1);
+  ASSERT(mjson_get_i64(s, n, "$[6]", &i) == 1 && i == -1);
+  ASSERT(mjson_get_u64(s, n, "$[6]", &u) == -1);
+  ASSERT(mjson_get_i64(s, n, "$[7]", &i) == 0);
+  ASSERT(mjson_get_i64(s, n, "$[8]", &i) == 0);
+  ASSERT(mjson_get_i64(s, n, "$[9]", &i) == 0);
+  ASSERT(mjson_get_u64(s, n, "$[10]", &u) == 1 && u == 0);
+  ASSERT(mjson_get_i64(s, n, "$[11]", &i) == 0);
+  ASSERT(mjson_get_i64(s, n, "$[0]", NULL) == 1);
+}
+
 static void test_get_string(void) {
   char buf[100];
   {
@@ -236,6 +736,36 @@ static void test_get_string(void) {
     ASSERT(strcmp(buf, "0\n\xfeg") == 0);
   }
 
+  {
+    // URL-safe alphabet, no padding, strict checks, long inputs
+    const char *s = "[\"MAr-Zw\",\"MAr_\",\"MA=A\",\"MAo\",\"M\",\"MB==\"]";
+    char b64[410], big[300], out[310];
+    struct mjson_fixedbuf fb = {b64, sizeof(b64), 0};
+    int i, n = (int) strlen(s);
+    ASSERT(mjson_get_base64(s, n, "$[0]", buf, sizeof(buf)) == 4);
+    ASSERT(strcmp(buf, "0\n\xfeg") == 0);
+    ASSERT(mjson_get_base64(s, n, "$[1]", buf, sizeof(buf)) == 3);
+    ASSERT(strcmp(buf, "0\n\xff") == 0);
+    ASSERT(mjson_get_base64(s, n, "$[2]", buf, sizeof(buf)) == -1);
+    ASSERT(mjson_get_base64(s, n, "$[3]", buf, sizeof(buf)) == 2);
+    ASSERT(mjson_get_base64(s, n, "$[4]", buf, sizeof(buf)) == -1);
+    ASSERT(mjson_get_base64(s, n, "$[5]", buf, sizeof(buf)) == -1);
+    for (i = 0; i < 300; i++) big[i] = (char) (i * 7);
+    ASSERT(mjson_printf(mjson_print_fixed_buf, &fb, "%V", 300, big) == 402);
+    ASSERT(mjson_base64_dec(b64 + 1, 400, out, sizeof(out)) == 300);
+    ASSERT(memcmp(out, big, 300) == 0);
+    ASSERT(mjson_base64_dec(b64 + 1, 400, out, 100) == 100);
+    ASSERT(memcmp(out, big, 100) == 0);
+    fb.ptr = out, fb.size = sizeof(out), fb.len = 0;
+    memset(out, 0, sizeof(out));
+    ASSERT(mjson_base64_dec_fn(b64 + 1, 400, mjson_print_fixed_buf, &fb) ==
+           300);
+    ASSERT(fb.len == 300 && memcmp(out, big, 300) == 0);
+    b64[351] = '*';
+    ASSERT(mjson_base64_dec(b64 + 1, 400, out, sizeof(out)) == -1);
+    ASSERT(mjson_base64_dec_fn(b64 + 1, 400, mjson_print_null, NULL) == -1);
+  }
+
   {
     const char *s = "[\"200a\",\"fe31\",123]";
     ASSERT(mjson_get_hex(s, strlen(s), "$[0]", buf, sizeof(buf)) == 2);
@@ -245,6 +775,27 @@ static void test_get_string(void) {
     ASSERT(mjson_get_hex(s, strlen(s), "$[2]", buf, sizeof(buf)) < 0);
   }
 
+  {
+    // Long strings go through the vector loops, bad digits are reported
+    char hex[200], bin[100];
+    int i, off = -1;
+    for (i = 0; i < 200; i++) hex[i] = "0123456789abcdefABCDEF"[i % 22];
+    ASSERT(mjson_hex_dec(hex, 200, bin, sizeof(bin), &off) == 100);
+    ASSERT(bin[0] == 0x01 && bin[5] == (char) 0xab && bin[11] == 0x01);
+    ASSERT(bin[8] == (char) 0xab && bin[99] == 0x01 && off == -1);
+    ASSERT(mjson_hex_dec(hex, 200, bin, 10, &off) == 10);
+    hex[150] = 'g';
+    ASSERT(mjson_hex_dec(hex, 200, bin, sizeof(bin), &off) == -1);
+    ASSERT(off == 150);
+    hex[150] = '0', hex[7] = '\xff';
+    ASSERT(mjson_hex_dec(hex, 200, bin, sizeof(bin), &off) == -1 && off == 7);
+    ASSERT(mjson_hex_dec(hex, 5, bin, sizeof(bin), &off) == -1 && off == 4);
+    // Digits past the end of dst are checked too
+    ASSERT(mjson_hex_dec("00zz", 4, bin, 1, &off) == -1 && off == 2);
+    ASSERT(mjson_hex_dec("00ff", 4, bin, 1, &off) == 1 && bin[0] == 0);
+    ASSERT(mjson_get_hex("\"0x\"", 4, "$", buf, sizeof(buf)) == -1);
+  }
+
   {
     const char *s = "[1,2]";
     double dv;
@@ -259,6 +810,106 @@ static void test_get_string(void) {
     ASSERT(mjson_get_string(s, strlen(s), "$[2]", buf, sizeof(buf)) > 0);
     ASSERT(strcmp(buf, expected) == 0);
   }
+
+  {
+    char doc[] = "{\"a\":\"plain\",\"b\":\"x\\ty\\u0041\",\"c\":\"\\q\"}";
+    const char *p = NULL;
+    int n = (int) strlen(doc), esc = -1;
+    ASSERT(mjson_get_string_view(doc, n, "$.a", &p, &esc) == 5);
+    ASSERT(p == doc + 6 && esc == 0);
+    ASSERT(mjson_get_string_view(doc, n, "$.b", &p, &esc) == 10 && esc == 1);
+    ASSERT(mjson_unescape_inplace((char *) p, 10) == 4);
+    ASSERT(memcmp(p, "x\tyA", 4) == 0 && p[10] == '"');
+    ASSERT(mjson_get_string_view(doc, n, "$.c", &p, &esc) == 2 && esc == 1);
+    ASSERT(mjson_unescape_inplace((char *) p, 2) == -1);
+    ASSERT(mjson_get_string_view(doc, n, "$", &p, NULL) == -1);
+    ASSERT(mjson_get_string_view(doc, n, "$.a", NULL, NULL) == 5);
+  }
+
+  {
+    // \u escapes decode to UTF-8, surrogate pairs included
+    const char *s =
+        "[\"\\u00e9\\u20AC\\ud83d\\ude00\\/\",\"\\u0041b\\u07ff\","
+        "\"\\ud83d\",\"\\ude00\",\"\\ud83dx\",\"\\u12g4\",\"\\u12\"]";
+    int n = (int) strlen(s);
+    ASSERT(mjson_get_string(s, n, "$[0]", buf, sizeof(buf)) == 10);
+    ASSERT(strcmp(buf, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80/") == 0);
+    ASSERT(mjson_get_string(s, n, "$[1]", buf, sizeof(buf)) == 4);
+    ASSERT(strcmp(buf, "Ab\xdf\xbf") == 0);
+    ASSERT(mjson_get_string(s, n, "$[0]", buf, 5) == -1);
+    ASSERT(mjson_get_string(s, n, "$[2]", buf, sizeof(buf)) == -1);
+    ASSERT(mjson_get_string(s, n, "$[3]", buf, sizeof(buf)) == -1);
+    ASSERT(mjson_get_string(s, n, "$[4]", buf, sizeof(buf)) == -1);
+    ASSERT(mjson_get_string(s, n, "$[5]", buf, sizeof(buf)) == -1);
+    ASSERT(mjson_get_string(s, n, "$[6]", buf, sizeof(buf)) == -1);
+  }
+}
+
+struct bind_test {
+  double temp;
+  int id, on, pins[4];
+  char name[8];
+  struct {
+    int level;
+    double ids[2];
+  } sub;
+};
+
+static void test_bind(void) {
+  static const struct mjson_bind_field desc[] = {
+      {"$.temp", MJSON_BIND_NUMBER, offsetof(struct bind_test, temp),
+       sizeof(double)},
+      {"$.id", MJSON_BIND_INT, offsetof(struct bind_test, id), sizeof(int)},
+      {"$.on", MJSON_BIND_BOOL, offsetof(struct bind_test, on), sizeof(int)},
+      {"$.pins[*]", MJSON_BIND_INT, offsetof(struct bind_test, pins),
+       4 * sizeof(int)},
+      {"$.name", MJSON_BIND_STRING, offsetof(struct bind_test, name), 8},
+      {"$.sub.level", MJSON_BIND_INT, offsetof(struct bind_test, sub.level),
+       sizeof(int)},
+      {"$.sub.list[*].id", MJSON_BIND_NUMBER,
+       offsetof(struct bind_test, sub.ids), 2 * sizeof(double)},
+  };
+  struct bind_test t;
+  const char *s =
+      "{\"name\":\"a\\tb\",\"x\":[{\"temp\":1}],\"temp\":-2.5,\"on\":true,"
+      "\"pins\":[5,6,7,8,9],\"sub\":{\"list\":[{\"id\":1},{\"id\":2},"
+      "{\"id\":3}],\"level\":3},\"id\":42.7}";
+  memset(&t, 0, sizeof(t));
+  ASSERT(mjson_bind(s, (int) strlen(s), desc, 7, &t) == 0x7f);
+  ASSERT(t.temp == -2.5 && t.id == 42 && t.on == 1);
+  ASSERT(t.pins[0] == 5 && t.pins[3] == 8);
+  ASSERT(strcmp(t.name, "a\tb") == 0);
+  ASSERT(t.sub.level == 3 && t.sub.ids[0] == 1 && t.sub.ids[1] == 2);
+
+  // Missing fields, wrong types and strings that don't fit are not bound
+  memset(&t, 0, sizeof(t));
+  s = "{\"id\":\"5\",\"on\":false,\"name\":\"too long\",\"pins\":[1]}";
+  ASSERT(mjson_bind(s, (int) strlen(s), desc, 7, &t) == 0xc);
+  ASSERT(t.id == 0 && t.on == 0 && t.pins[0] == 1 && t.pins[1] == 0);
+  ASSERT(t.name[0] == '\0');
+
+  // Numbers that don't fit into an int are not bound
+  memset(&t, 0, sizeof(t));
+  s = "{\"id\":1e20,\"pins\":[-1e300,-7.9]}";
+  ASSERT(mjson_bind(s, (int) strlen(s), desc, 7, &t) == 0x8);
+  ASSERT(t.id == 0 && t.pins[0] == 0 && t.pins[1] == -7);
+
+  // Stop as soon as every field is bound
+  s = "{\"temp\":1,\"id\":2,garbage";
+  ASSERT(mjson_bind(s, (int) strlen(s), desc, 2, &t) == 3);
+  ASSERT(mjson_bind(s, (int) strlen(s), desc, 3, &t) ==
+         MJSON_ERROR_INVALID_INPUT);
+  ASSERT(mjson_bind("7", 1, desc, 0, &t) == 0);
+  {
+    static const struct mjson_bind_field bad[] = {
+        {"$..id", MJSON_BIND_INT, 0, sizeof(int)},
+        {"$.a[*][*]", MJSON_BIND_INT, 0, sizeof(int)},
+        {"$.a[*]", MJSON_BIND_STRING, 0, 8},
+    };
+    ASSERT(mjson_bind("{}", 2, bad, 1, &t) == MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_bind("{}", 2, bad + 1, 1, &t) == MJSON_ERROR_INVALID_INPUT);
+    ASSERT(mjson_bind("{}", 2, bad + 2, 1, &t) == MJSON_ERROR_INVALID_INPUT);
+  }
 }
 
 static void test_print(void) {
@@ -581,6 +1232,9 @@ static void test_merge(void) {
       "{\"a\":1}",  // Delete non-existing key
       "{\"b\":null}",
       "{\"a\":1}",
+      "{\"a\":1,\"b\":[1,}],\"c\":3}",  // Invalid nested value
+      "{\"c\":4}",
+      "{\"a\":1,\"c\":4}",
   };
   for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i += 3) {
     struct mjson_fixedbuf fb = {buf, sizeof(buf), 0};
@@ -635,6 +1289,31 @@ static void test_pretty(void) {
   }
 }
 
+static int foreach_cb(const char *s, int index, int koff, int klen, int voff,
+                      int vlen, int vtype, void *ud) {
+  mjson_printf(mjson_print_fixed_buf, ud, "%d:%.*s:%.*s:%d|", index, klen,
+               s + koff, vlen, s + voff, vtype);
+  return index == 2;
+}
+
+static void test_foreach(void) {
+  char buf[100];
+  struct mjson_fixedbuf fb = {buf, sizeof(buf), 0};
+  const char *s = "{\"a\":1,\"b\":[2,{\"c\":3}],\"d\":\"x\",\"e\":null}";
+  ASSERT(mjson_foreach(s, (int) strlen(s), foreach_cb, &fb) == 3);
+  ASSERT(strcmp(buf,
+                "0:\"a\":1:12|1:\"b\":[2,{\"c\":3}]:91|"
+                "2:\"d\":\"x\":11|") == 0);
+  fb.len = 0;
+  s = " [ [], true, {} ] ";
+  ASSERT(mjson_foreach(s, (int) strlen(s), foreach_cb, &fb) == 3);
+  ASSERT(strcmp(buf, "0::[]:91|1::true:13|2::{}:123|") == 0);
+  ASSERT(mjson_foreach("[]", 2, foreach_cb, &fb) == 0);
+  ASSERT(mjson_foreach("7", 1, foreach_cb, &fb) == 0);
+  ASSERT(mjson_foreach("[1,", 3, foreach_cb, &fb) ==
+         MJSON_ERROR_INVALID_INPUT);
+}
+
 static void test_next(void) {
   int a, b, c, d, t;
 
@@ -682,6 +1361,202 @@ static void test_next(void) {
     ASSERT(a == 5 && b == 0 && c == 27 && d == 4 && t == MJSON_TOK_STRING);
     ASSERT(mjson_next(s, strlen(s), 31, &a, &b, &c, &d, &t) == 0);
   }
+
+  {
+    const char *s = "{\"a\":123,\"b\":[1,2,3,{\"c\":1}],\"d\":null}";
+    ptrdiff_t off64 = 0, a64, b64, c64, d64;
+    int off = 0, t64;
+    do {
+      off = mjson_next(s, strlen(s), off, &a, &b, &c, &d, &t);
+      off64 = mjson_next64(s, (ptrdiff_t) strlen(s), off64, &a64, &b64, &c64,
+                           &d64, &t64);
+      ASSERT(off64 == off);
+      ASSERT(off == 0 || (a64 == a && b64 == b && c64 == c && d64 == d &&
+                          t64 == t));
+    } while (off > 0);
+  }
+
+  {
+    // A cursor returns the same children as mjson_next()
+    const char *docs[] = {"{\"a\":123,\"b\":[1,2,3,{\"c\":1}],\"d\":null}",
+                          "[3,null,{},[1,2],{\"x\":[3]},\"hi\"]",
+                          " { } ", "[]", "7", "{\"a\":[[[]]], \"\":{}}"};
+    int i, off, n, ok = 1, k2, l2, v2, w2, t2;
+    for (i = 0; i < (int) (sizeof(docs) / sizeof(docs[0])); i++) {
+      struct mjson_cursor cur;
+      memset(&cur, 0, sizeof(cur));
+      off = 0;
+      do {
+        off = mjson_next(docs[i], strlen(docs[i]), off, &a, &b, &c, &d, &t);
+        n = mjson_next_cursor(&cur, docs[i], strlen(docs[i]), &k2, &l2, &v2,
+                              &w2, &t2);
+        if (n != off) ok = 0;
+        if (n > 0 && (k2 != a || l2 != b || v2 != c || w2 != d || t2 != t)) {
+          ok = 0;
+        }
+      } while (off > 0);
+      if (mjson_next_cursor(&cur, docs[i], strlen(docs[i]), 0, 0, 0, 0, 0)) {
+        ok = 0;
+      }
+    }
+    ASSERT(ok);
+  }
+
+  {
+    struct mjson_cursor cur;
+    memset(&cur, 0, sizeof(cur));
+    ASSERT(mjson_next_cursor(&cur, "[1,}", 4, &a, &b, &c, &d, &t) == 2);
+    ASSERT(mjson_next_cursor(&cur, "[1,}", 4, &a, &b, &c, &d, &t) ==
+           MJSON_ERROR_INVALID_INPUT);
+  }
+}
+
+static void test_index(void) {
+  struct mjson_tape_entry entries[30];
+  struct mjson_tape t = {entries, sizeof(entries) / sizeof(entries[0]), 0, 0};
+  const char *s =
+      "{\"a\":{\"c\":null},\"c\":2,\"b\":[1,{\"x\":[3]},[],\"hi\"],"
+      "\"s\":\"a\\nb\",\"t\":true,\"h\":\"fe31\",\"v\":\"MAr+\"}";
+  const char *paths[] = {"$",        "$.a",     "$.a.c",  "$.c",
+                         "$.b",      "$.b[0]",  "$.b[1]", "$.b[1].x",
+                         "$.b[2]",   "$.b[3]",  "$.b[4]", "$.b[1].x[0]",
+                         "$.b[1].y", "$.a.c.d", "$.x",    "$[0]",
+                         "$.b.x",    "$.s",     "",       "$.c[0]",
+                         "$.b[]",    "$.b[4294967297]", "$.b[0].x"};
+  const char *p1, *p2;
+  char buf[20];
+  double v;
+  int i, n1, n2, b;
+
+  ASSERT(mjson_index(s, (int) strlen(s), &t) == 24);
+  ASSERT(t.n == 24 && t.entries[0].type == MJSON_TOK_OBJECT);
+  ASSERT(t.entries[0].len == (int) strlen(s) && t.entries[0].next == 24);
+  ASSERT(t.entries[1].type == MJSON_TOK_KEY && t.entries[1].depth == 1);
+  for (i = 0; i < (int) (sizeof(paths) / sizeof(paths[0])); i++) {
+    int tok = mjson_find(s, (int) strlen(s), paths[i], &p1, &n1);
+    ASSERT((int) mjson_find_ix(&t, paths[i], &p2, &n2) == tok);
+    if (tok != MJSON_TOK_INVALID) ASSERT(p1 == p2 && n1 == n2);
+  }
+  ASSERT(mjson_get_number_ix(&t, "$.b[1].x[0]", &v) == 1 && v == 3);
+  ASSERT(mjson_get_number_ix(&t, "$.b[3]", &v) == 0);
+  ASSERT(mjson_get_bool_ix(&t, "$.t", &b) == 1 && b == 1);
+  ASSERT(mjson_get_string_ix(&t, "$.s", buf, sizeof(buf)) == 3);
+  ASSERT(strcmp(buf, "a\nb") == 0);
+  ASSERT(mjson_get_hex_ix(&t, "$.h", buf, sizeof(buf)) == 2);
+  ASSERT(strcmp(buf, "\xfe\x31") == 0);
+  ASSERT(mjson_get_base64_ix(&t, "$.v", buf, sizeof(buf)) == 3);
+  ASSERT(strcmp(buf, "0\n\xfe") == 0);
+
+  t.size = 23;
+  ASSERT(mjson_index(s, (int) strlen(s), &t) == MJSON_ERROR_TOO_LONG);
+  ASSERT(mjson_find_ix(&t, "$", NULL, NULL) == MJSON_TOK_INVALID);
+  ASSERT(mjson_index("[1,", 3, &t) == MJSON_ERROR_INVALID_INPUT);
+  ASSERT(mjson_index("7", 1, &t) == 1);
+  ASSERT(mjson_get_number_ix(&t, "$", &v) == 1 && v == 7);
+  {
+    mjson_int64_t i64 = 0;
+    mjson_uint64_t u64 = 0;
+    ASSERT(mjson_get_i64_ix(&t, "$", &i64) == 1 && i64 == 7);
+    ASSERT(mjson_get_u64_ix(&t, "$", &u64) == 1 && u64 == 7);
+  }
+  // Indices need digits, and must fit into an int
+  ASSERT(mjson_index("[1,2]", 5, &t) == 3);
+  ASSERT(mjson_get_number_ix(&t, "$[1]", &v) == 1 && v == 2);
+  ASSERT(mjson_find_ix(&t, "$[]", NULL, NULL) == MJSON_TOK_INVALID);
+  ASSERT(mjson_find_ix(&t, "$[99999999999]", NULL, NULL) == MJSON_TOK_INVALID);
+  ASSERT(mjson_find_ix(&t, "$[4294967296]", NULL, NULL) == MJSON_TOK_INVALID);
+
+  {
+    // Large arrays, with skip points every MJSON_INDEX_STRIDE elements
+    static struct mjson_tape_entry big[700];
+    static char doc[3000];
+    struct mjson_tape tb = {big, sizeof(big) / sizeof(big[0]), 0, 0};
+    char path[30];
+    const char *p1, *p2;
+    int i, n1, n2, n = 0, ok = 1;
+    n += sprintf(doc + n, "{\"a\":[");
+    for (i = 0; i < 300; i++) {
+      n += sprintf(doc + n, i % 7 == 3 ? "%s[%d,[]]" : "%s%d", i ? "," : "", i);
+    }
+    n += sprintf(doc + n, "]}");
+    ASSERT(mjson_index(doc, n, &tb) > 0);
+    for (i = 0; i <= 300; i++) {
+      int tok;
+      sprintf(path, i % 7 == 3 ? "$.a[%d][0]" : "$.a[%d]", i);
+      tok = mjson_find(doc, n, path, &p1, &n1);
+      if ((int) mjson_find_ix(&tb, path, &p2, &n2) != tok) ok = 0;
+      if (tok != MJSON_TOK_INVALID && (p1 != p2 || n1 != n2)) ok = 0;
+    }
+    ASSERT(ok);
+    ASSERT(mjson_get_number_ix(&tb, "$.a[299]", &v) == 1 && v == 299);
+    ASSERT(mjson_find_ix(&tb, "$.a[300]", NULL, NULL) == MJSON_TOK_INVALID);
+  }
+}
+
+static void test_cache(void) {
+  static struct mjson_cache_entry entries[8];
+  struct mjson_cache c = {entries, 8, 0, 0};
+  const char *s1 = "{\"a\":{\"b\":[1,2]},\"c\":true}", *s2 = "{\"a\":3}";
+  const char *p;
+  int i, len;
+  ASSERT(mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1), "$.a.b[1]", &p,
+                           &len) == MJSON_TOK_NUMBER);
+  ASSERT(len == 1 && *p == '2' && c.hits == 0);
+  ASSERT(mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1), "$.a.b[1]", &p,
+                           &len) == MJSON_TOK_NUMBER);
+  ASSERT(len == 1 && *p == '2' && c.hits == 1);
+  ASSERT(mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1), "$.x", &p, &len) ==
+         MJSON_TOK_INVALID);
+  ASSERT(mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1), "$.x", &p, &len) ==
+         MJSON_TOK_INVALID);
+  ASSERT(c.hits == 2);
+
+  // A new version of the document is looked up again
+  ASSERT(mjson_find_cached(&c, 1, 2, s2, (int) strlen(s2), "$.a", &p, &len) ==
+         MJSON_TOK_NUMBER);
+  ASSERT(len == 1 && *p == '3' && c.hits == 2);
+  ASSERT(mjson_find_cached(&c, 2, 1, s1, (int) strlen(s1), "$.a", &p, &len) ==
+         MJSON_TOK_OBJECT);
+  ASSERT(c.hits == 2);
+  mjson_cache_invalidate(&c, 2);
+  ASSERT(mjson_find_cached(&c, 2, 1, s2, (int) strlen(s2), "$.a", &p, &len) ==
+         MJSON_TOK_NUMBER);
+  ASSERT(c.hits == 2);
+
+  // Entries are recycled, least recently used first
+  for (i = 0; i < 100; i++) {
+    char path[20];
+    sprintf(path, "$.a.b[%d]", i % 10);
+    mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1), path, &p, &len);
+    mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1), "$.c", &p, &len);
+  }
+  // "$.c" stays, the ten "$.a.b[N]" paths keep evicting each other
+  ASSERT(c.clock == 207 && c.hits == 102);
+  ASSERT(mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1), "$.c", &p, &len) ==
+         MJSON_TOK_TRUE);
+  ASSERT(mjson_find_cached(&c, 1, 1, s1, (int) strlen(s1),
+                           "$.a.b[0].xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx",
+                           &p, &len) == MJSON_TOK_INVALID);
+
+  {
+    // With fewer entries than two buckets, all of them form one bucket
+    static struct mjson_cache_entry e6[6];
+    struct mjson_cache c6 = {e6, 6, 0, 0};
+    const char *paths[] = {"$.a", "$.b", "$.c", "$.d", "$.e", "$.f", "$.g"};
+    for (i = 0; i < 12; i++) {
+      mjson_find_cached(&c6, 1, 1, s1, (int) strlen(s1), paths[i % 6], &p,
+                        &len);
+    }
+    ASSERT(c6.clock == 12 && c6.hits == 6);
+    // A seventh path evicts the least recently used one, "$.a"
+    mjson_find_cached(&c6, 1, 1, s1, (int) strlen(s1), paths[6], &p, &len);
+    for (i = 1; i < 6; i++) {
+      mjson_find_cached(&c6, 1, 1, s1, (int) strlen(s1), paths[i], &p, &len);
+    }
+    ASSERT(c6.clock == 18 && c6.hits == 11);
+    mjson_find_cached(&c6, 1, 1, s1, (int) strlen(s1), paths[0], &p, &len);
+    ASSERT(c6.clock == 19 && c6.hits == 11);
+  }
 }
 
 static void test_globmatch(void) {
@@ -703,19 +1578,94 @@ static void test_globmatch(void) {
   ASSERT(mjson_globmatch("#", 1, "///", 3) == 1);
 }
 
+#if defined(__cplusplus) && __cplusplus >= 202002L
+// Compare a compiled-in path lookup with mjson_find()
+template <mjsonpp::path P>
+static bool find_same(const char *s) {
+  const char *p = NULL;
+  int n = 0, tok = mjson_find(s, (int) strlen(s), P.str, &p, &n);
+  mjsonpp::value v = mjsonpp::find<P>(s);
+  if (tok != v.tok) return false;
+  return !v || (v.str.data() == p && (int) v.str.size() == n);
+}
+
+static void test_find_ct(void) {
+  const char *s = "{\"a\": {\"x\": [1, {\"b\": [10, 20, 30]}], "
+                  "\"b\": [true, null, \"s\", [4], {}]}, \"aa\": 1, \"\": 2}";
+  const char *bad[] = {"", "[1, 2", "{\"a\" 1}", "{\"a\": [1}"};
+  size_t i;
+  mjsonpp::value v = mjsonpp::find<"$.a.x[1].b[2]">(s);
+  ASSERT(v.tok == MJSON_TOK_NUMBER && v.str == "30");
+  ASSERT(mjsonpp::find<"$.a.b[4]">(s).str == "{}");
+  ASSERT(mjsonpp::find<"$.a.b[3]">(s).tok == MJSON_TOK_ARRAY);
+  ASSERT(!mjsonpp::find<"$.a.b[5]">(s));
+  ASSERT(!mjsonpp::find<"$.a.c">(s));
+  ASSERT(mjsonpp::find<"$">(s).str == s);
+  ASSERT(find_same<"$">(s));
+  ASSERT(find_same<"$.">(s));
+  ASSERT(find_same<"$.a">(s));
+  ASSERT(find_same<"$.aa">(s));
+  ASSERT(find_same<"$.a.x">(s));
+  ASSERT(find_same<"$.a.x[0]">(s));
+  ASSERT(find_same<"$.a.x[1]">(s));
+  ASSERT(find_same<"$.a.x[1].b">(s));
+  ASSERT(find_same<"$.a.x[1].b[0]">(s));
+  ASSERT(find_same<"$.a.x[1].b[3]">(s));
+  ASSERT(find_same<"$.a.x[2]">(s));
+  ASSERT(find_same<"$.a.x.b">(s));
+  ASSERT(find_same<"$.a.b[0]">(s));
+  ASSERT(find_same<"$.a.b[1]">(s));
+  ASSERT(find_same<"$.a.b[2]">(s));
+  ASSERT(find_same<"$.a.b[3][0]">(s));
+  ASSERT(find_same<"$.a.b[3][1]">(s));
+  ASSERT(find_same<"$.a.b[4].x">(s));
+  ASSERT(find_same<"$.aa.b">(s));
+  ASSERT(find_same<"$[0]">(s));
+  ASSERT(find_same<"$[0]">("[[], 2]"));
+  ASSERT(find_same<"$[1]">("[[], 2]"));
+  ASSERT(find_same<"$[0][0]">("[[], 2]"));
+  ASSERT(find_same<"$[0].a">("[\"x\", {\"a\": 1}]"));
+  ASSERT(find_same<"$[0].a">("[{}, {\"a\": 1}]"));
+  ASSERT(find_same<"$[1].a">("[{}, {\"a\": 1}]"));
+  ASSERT(find_same<"$.b[0].a">("{\"b\": [\"x\", {\"a\": 1}]}"));
+  ASSERT(find_same<"$.b[0].a">("{\"b\": [{}, {\"a\": 1}]}"));
+  ASSERT(find_same<"$.a[0].b">("{\"a\": [5], \"x\": [{\"b\": 1}]}"));
+  ASSERT(find_same<"$.a">("{\"a\": 1, \"a\": 2}"));
+  ASSERT(find_same<"$.a">("\"a\""));
+  ASSERT(find_same<"$.a[1]">("{\"a\": [1, 2}"));
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    ASSERT(!mjsonpp::find<"$.a[1]">(bad[i]));
+  }
+  // Found before the error
+  ASSERT(mjsonpp::find<"$[0]">("[1, 2 x").str == "1");
+}
+#endif
+
 int main() {
   test_next();
+  test_foreach();
   test_printf();
   test_cb();
+  test_stream();
+  test_tokenize();
+  test_validate();
   test_find();
+#if defined(__cplusplus) && __cplusplus >= 202002L
+  test_find_ct();
+#endif
+  test_query();
   test_get_number();
   test_get_bool();
+  test_get_int64();
   test_get_string();
+  test_bind();
   test_print();
   test_rpc();
   test_merge();
   test_pretty();
   test_globmatch();
+  test_index();
+  test_cache();
   printf("%s. Total tests: %d, failed: %d\n",
          s_num_errors ? "FAILURE" : "SUCCESS", s_num_tests, s_num_errors);
   return s_num_errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;